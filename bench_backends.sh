@@ -0,0 +1,30 @@
+#!/bin/sh
+# Compare the collector backends side by side on the test programs:
+# builds the project once per STELLA_GC_BACKEND and reports wall time and peak RSS of every test.
+# Usage: ./bench_backends.sh [input]   (the input is fed to every test program, default 5)
+# Needs GNU time (/usr/bin/time) for the peak RSS.
+
+input=${1:-5}
+backends="incremental cheney compact"
+
+for backend in $backends; do
+  cmake -S . -B "build-bench-$backend" -DCMAKE_BUILD_TYPE=Release -DSTELLA_GC_BACKEND=$backend > /dev/null \
+    && cmake --build "build-bench-$backend" > /dev/null \
+    || { echo "::error::build with STELLA_GC_BACKEND=$backend failed"; exit 1; }
+done
+
+printf "%-24s" "test"
+for backend in $backends; do
+  printf "%28s" "$backend (s / peak KiB)"
+done
+echo ""
+
+for file in "build-bench-incremental/bin"/*; do
+  test=$(basename "$file")
+  printf "%-24s" "$test"
+  for backend in $backends; do
+    result=$(echo "$input" | /usr/bin/time -f "%e %M" -o /dev/stdout "build-bench-$backend/bin/$test" 2> /dev/null | tail -1)
+    printf "%28s" "$result"
+  done
+  echo ""
+done
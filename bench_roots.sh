@@ -0,0 +1,23 @@
+#!/bin/sh
+# Compare the shadow stack of roots with the conservative scan of the native stack (STELLA_GC_CONSERVATIVE)
+# on closure-heavy programs: builds the cheney backend both ways and puts the metrics of
+# stella_gc_roots_bench side by side.
+# Usage: ./bench_roots.sh [scale]   (the scale of the workloads, default 1)
+
+scale=${1:-1}
+modes="shadow conservative"
+
+for mode in $modes; do
+  conservative=OFF
+  [ "$mode" = conservative ] && conservative=ON
+  cmake -S stella-runtime -B "build-roots-$mode" -DCMAKE_BUILD_TYPE=Release -DSTELLA_GC_BACKEND=cheney \
+      -DSTELLA_GC_CONSERVATIVE=$conservative -DSTELLA_GC_BENCHMARKS=ON > /dev/null \
+    && cmake --build "build-roots-$mode" --target stella_gc_roots_bench > /dev/null \
+    || { echo "::error::build with STELLA_GC_CONSERVATIVE=$conservative failed"; exit 1; }
+done
+
+"build-roots-shadow/stella_gc_roots_bench" "$scale" | grep -v '^#' > build-roots-shadow/results.txt
+"build-roots-conservative/stella_gc_roots_bench" "$scale" | grep -v '^#' > build-roots-conservative/results.txt
+
+printf "%-32s %16s %16s\n" "metric" "shadow" "conservative"
+paste build-roots-shadow/results.txt build-roots-conservative/results.txt | awk '{ printf "%-32s %16s %16s\n", $1, $2, $4 }'
@@ -0,0 +1,230 @@
+//
+// Mutator traversal time and cache misses after a collection, for every copy order
+// (STELLA_GC_COPY_ORDER), with the time of the two collections that laid the data out (gc-ms).
+// Every order runs in its own child process, so that it gets a fresh heap.
+// Usage: stella_gc_copy_order_bench [tree depth] [list length] [passes]
+//
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+static const char *orders[] = {"breadth", "chase", "depth"};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/** A hardware cache event of the calling thread, or -1 where perf_event_open is not available
+ * (other systems, kernel.perf_event_paranoid, containers).
+ */
+static int open_counter(uint32_t type, uint64_t config) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void start_counter(int fd) {
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+/** Formats the count of the counter since start_counter, "n/a" if it could not be opened. */
+static void stop_counter(int fd, char *out, size_t cap) {
+    long long count = -1;
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof count) != sizeof count) {
+            count = -1;
+        }
+    }
+#endif
+    if (count < 0) {
+        snprintf(out, cap, "n/a");
+    } else {
+        snprintf(out, cap, "%lld", count);
+    }
+}
+
+static stella_object *tuple3(stella_object *a, stella_object *b, stella_object *c) {
+    gc_push_root((void **) &a);
+    gc_push_root((void **) &b);
+    gc_push_root((void **) &c);
+    stella_object *t = alloc_stella_object(TAG_TUPLE, 3);
+    STELLA_OBJECT_INIT_FIELD(t, 0, a);
+    STELLA_OBJECT_INIT_FIELD(t, 1, b);
+    STELLA_OBJECT_INIT_FIELD(t, 2, c);
+    gc_pop_root((void **) &c);
+    gc_pop_root((void **) &b);
+    gc_pop_root((void **) &a);
+    return t;
+}
+
+static stella_object *cons(stella_object *head, stella_object *tail) {
+    gc_push_root((void **) &head);
+    gc_push_root((void **) &tail);
+    stella_object *c = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(c, 0, head);
+    STELLA_OBJECT_INIT_FIELD(c, 1, tail);
+    gc_pop_root((void **) &tail);
+    gc_pop_root((void **) &head);
+    return c;
+}
+
+/** Complete binary tree: nodes are (value, left, right) tuples, leaves the_UNIT. */
+static stella_object *make_tree(int depth, int *counter) {
+    if (depth == 0) {
+        return &the_UNIT;
+    }
+    stella_object *left = make_tree(depth - 1, counter), *right = NULL;
+    gc_push_root((void **) &left);
+    gc_push_root((void **) &right);
+    right = make_tree(depth - 1, counter);
+    stella_object *value = nat_to_stella_object((*counter)++ % 200);
+    stella_object *node = tuple3(value, left, right);
+    gc_pop_root((void **) &right);
+    gc_pop_root((void **) &left);
+    return node;
+}
+
+static long sum_tree(stella_object *node) {
+    if (STELLA_OBJECT_HEADER_TAG(node->object_header) != TAG_TUPLE) {
+        return 0;
+    }
+    return stella_object_to_nat(STELLA_OBJECT_READ_FIELD(node, 0))
+           + sum_tree(STELLA_OBJECT_READ_FIELD(node, 1))
+           + sum_tree(STELLA_OBJECT_READ_FIELD(node, 2));
+}
+
+/** List of (n, n + 1, unit) tuples. */
+static stella_object *make_list(int length) {
+    stella_object *list = &the_EMPTY, *element = NULL, *n = NULL;
+    gc_push_root((void **) &list);
+    gc_push_root((void **) &element);
+    gc_push_root((void **) &n);
+    for (int i = 0; i < length; i++) {
+        n = nat_to_stella_object(i % 200);
+        element = nat_to_stella_object(i % 200 + 1);
+        element = tuple3(n, element, &the_UNIT);
+        list = cons(element, list);
+    }
+    gc_pop_root((void **) &n);
+    gc_pop_root((void **) &element);
+    gc_pop_root((void **) &list);
+    return list;
+}
+
+static long sum_list(stella_object *list) {
+    long sum = 0;
+    for (; STELLA_OBJECT_HEADER_TAG(list->object_header) == TAG_CONS; list = STELLA_OBJECT_READ_FIELD(list, 1)) {
+        stella_object *element = STELLA_OBJECT_READ_FIELD(list, 0);
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(element, 0))
+               + stella_object_to_nat(STELLA_OBJECT_READ_FIELD(element, 1));
+    }
+    return sum;
+}
+
+/** Allocate garbage until two more complete collections have copied the live data in the current order. */
+static void collect_twice() {
+    const gc_stats *stats = gc_current_stats();
+    size_t cycles = stats->major_gc_cycles;
+    while (stats->major_gc_cycles < cycles + 2 || gc_current_state()->gc_running) {
+        stella_object *garbage = alloc_stella_object(TAG_CONS, 2);
+        STELLA_OBJECT_INIT_FIELD(garbage, 0, &the_ZERO);
+        STELLA_OBJECT_INIT_FIELD(garbage, 1, &the_EMPTY);
+    }
+}
+
+static void traverse(const char *order, const char *workload, stella_object *root, int passes,
+                     long (*sum)(stella_object *), uint64_t gc_ns) {
+    int misses = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    int l1d_misses = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                                      | PERF_COUNT_HW_CACHE_OP_READ << 8
+                                                      | PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    long result = 0;
+    start_counter(misses);
+    start_counter(l1d_misses);
+    uint64_t start = now_ns();
+    for (int i = 0; i < passes; i++) {
+        result += sum(root);
+    }
+    uint64_t elapsed = now_ns() - start;
+    char misses_text[32], l1d_text[32];
+    stop_counter(misses, misses_text, sizeof misses_text);
+    stop_counter(l1d_misses, l1d_text, sizeof l1d_text);
+    printf("%-8s %-8s %12.3f %14s %14s %10.3f %12ld\n", order, workload, (double) elapsed / 1e6 / passes,
+           misses_text, l1d_text, (double) gc_ns / 1e6, result / passes);
+    fflush(stdout);
+}
+
+static void run(const char *order, int depth, int length, int passes) {
+    setenv("STELLA_GC_COPY_ORDER", order, 1);
+    int counter = 0;
+    stella_object *tree = make_tree(depth, &counter);
+    gc_push_root((void **) &tree);
+    stella_object *list = make_list(length);
+    gc_push_root((void **) &list);
+    uint64_t gc_ns = gc_current_stats()->gc_ns;
+    collect_twice();
+    gc_ns = gc_current_stats()->gc_ns - gc_ns;
+    traverse(order, "tree", tree, passes, sum_tree, gc_ns);
+    traverse(order, "list", list, passes, sum_list, gc_ns);
+    gc_pop_root((void **) &list);
+    gc_pop_root((void **) &tree);
+}
+
+int main(int argc, char **argv) {
+    int depth = argc > 1 ? atoi(argv[1]) : 18;
+    int length = argc > 2 ? atoi(argv[2]) : 200000;
+    int passes = argc > 3 ? atoi(argv[3]) : 10;
+#if defined(STELLA_GC_BACKEND_COMPACT) || defined(STELLA_GC_GENERATIONAL) || defined(STELLA_GC_PARALLEL) \
+    || STELLA_GC_STATS_LEVEL < STELLA_GC_STATS_CHEAP
+    printf("The copy order applies to the non-generational incremental and cheney backends"
+           " with at least cheap statistics (STELLA_GC_STATS_LEVEL)\n");
+    return 0;
+#endif
+
+    printf("%-8s %-8s %12s %14s %14s %10s %12s\n",
+           "order", "workload", "ms/pass", "cache-misses", "L1d-misses", "gc-ms", "sum");
+    for (size_t i = 0; i < sizeof orders / sizeof orders[0]; i++) {
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            run(orders[i], depth, length, passes);
+            exit(0);
+        }
+        int status;
+        waitpid(child, &status, 0);
+    }
+    return 0;
+}
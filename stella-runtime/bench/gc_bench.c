@@ -0,0 +1,313 @@
+//
+// Microbenchmarks of the collector driven from C, without the Stella compiler.
+// Every workload runs in its own child process, so that it starts with a fresh heap, and reports
+// one "workload.metric value" line per metric in a fixed order: runs of two builds can be diffed.
+// Usage: stella_gc_bench [scale] [workload...]   (workloads: lists trees refs succ, default all)
+//
+
+#define _DEFAULT_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static stella_object *cons(stella_object *head, stella_object *tail) {
+    gc_push_root((void **) &head);
+    gc_push_root((void **) &tail);
+    stella_object *c = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(c, 0, head);
+    STELLA_OBJECT_INIT_FIELD(c, 1, tail);
+    gc_pop_root((void **) &tail);
+    gc_pop_root((void **) &head);
+    return c;
+}
+
+static stella_object *pair(stella_object *left, stella_object *right) {
+    gc_push_root((void **) &left);
+    gc_push_root((void **) &right);
+    stella_object *t = alloc_stella_object(TAG_TUPLE, 2);
+    STELLA_OBJECT_INIT_FIELD(t, 0, left);
+    STELLA_OBJECT_INIT_FIELD(t, 1, right);
+    gc_pop_root((void **) &right);
+    gc_pop_root((void **) &left);
+    return t;
+}
+
+static stella_object *make_list(int length) {
+    stella_object *list = &the_EMPTY;
+    gc_push_root((void **) &list);
+    for (int i = 0; i < length; i++) {
+        stella_object *n = nat_to_stella_object(i % 100);
+        list = cons(n, list);
+    }
+    gc_pop_root((void **) &list);
+    return list;
+}
+
+static long sum_list(stella_object *list) {
+    long sum = 0;
+    for (; STELLA_OBJECT_HEADER_TAG(list->object_header) == TAG_CONS; list = STELLA_OBJECT_READ_FIELD(list, 1)) {
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(list, 0));
+    }
+    return sum;
+}
+
+static long expected_sum(int length) {
+    long sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += i % 100;
+    }
+    return sum;
+}
+
+/** A long-lived list, kept while many short-lived lists are built and summed. */
+static int run_lists(int scale) {
+    int ok = 1;
+    stella_object *live = make_list(100000);
+    gc_push_root((void **) &live);
+    for (int round = 0; round < 400 * scale; round++) {
+        stella_object *temporary = make_list(5000);
+        ok &= sum_list(temporary) == expected_sum(5000);
+    }
+    ok &= sum_list(live) == expected_sum(100000);
+    gc_pop_root((void **) &live);
+    return ok;
+}
+
+/** Complete binary tree of pairs, leaves the_UNIT, built bottom-up. */
+static stella_object *make_tree(int depth) {
+    if (depth == 0) {
+        return &the_UNIT;
+    }
+    stella_object *left = make_tree(depth - 1);
+    gc_push_root((void **) &left);
+    stella_object *right = make_tree(depth - 1);
+    stella_object *node = pair(left, right);
+    gc_pop_root((void **) &left);
+    return node;
+}
+
+static long count_nodes(stella_object *node) {
+    if (STELLA_OBJECT_HEADER_TAG(node->object_header) != TAG_TUPLE) {
+        return 0;
+    }
+    return 1 + count_nodes(STELLA_OBJECT_READ_FIELD(node, 0)) + count_nodes(STELLA_OBJECT_READ_FIELD(node, 1));
+}
+
+/** A long-lived tree, kept while temporary trees of growing depth churn the heap (as in GCBench). */
+static int run_trees(int scale) {
+    int ok = 1;
+    stella_object *live = make_tree(16);
+    gc_push_root((void **) &live);
+    for (int depth = 4; depth <= 14; depth += 2) {
+        int iterations = scale << (18 - depth);
+        for (int i = 0; i < iterations; i++) {
+            ok &= count_nodes(make_tree(depth)) == (1l << depth) - 1;
+        }
+    }
+    ok &= count_nodes(live) == (1l << 16) - 1;
+    gc_pop_root((void **) &live);
+    return ok;
+}
+
+#define REF_CELLS 1024
+
+/** Storms of assignments of fresh objects to long-lived ref cells (old-to-young pointers). */
+static int run_refs(int scale) {
+    int ok = 1;
+    stella_object *cells = alloc_stella_object(TAG_TUPLE, REF_CELLS);
+    for (int i = 0; i < REF_CELLS; i++) {
+        STELLA_OBJECT_INIT_FIELD(cells, i, &the_ZERO);
+    }
+    gc_push_root((void **) &cells);
+    for (int i = 0; i < REF_CELLS; i++) {
+        stella_object *ref = alloc_stella_object(TAG_REF, 1);
+        STELLA_OBJECT_INIT_FIELD(ref, 0, &the_ZERO);
+        STELLA_OBJECT_WRITE_FIELD(cells, i, ref);
+    }
+
+    uint32_t random = 2463534242u;
+    long written = 0;
+    for (long i = 0; i < 2000000l * scale; i++) {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        stella_object *value = pair(nat_to_stella_object((int) (i % 100)), &the_UNIT);
+        stella_object *ref = STELLA_OBJECT_READ_FIELD(cells, random % REF_CELLS);
+        STELLA_OBJECT_WRITE_FIELD(ref, 0, value);
+        written++;
+    }
+    for (int i = 0; i < REF_CELLS; i++) {
+        stella_object *value = STELLA_OBJECT_READ_FIELD(STELLA_OBJECT_READ_FIELD(cells, i), 0);
+        ok &= value == &the_ZERO || STELLA_OBJECT_HEADER_TAG(value->object_header) == TAG_TUPLE;
+    }
+    ok &= written == 2000000l * scale;
+    gc_pop_root((void **) &cells);
+    return ok;
+}
+
+/** Deep chains of succ objects: a long-lived one and many temporary ones. */
+static int run_succ(int scale) {
+    int ok = 1;
+    stella_object *live = nat_to_stella_object(50000);
+    gc_push_root((void **) &live);
+    for (int round = 0; round < 100 * scale; round++) {
+        stella_object *n = nat_to_stella_object(20000 + round);
+        ok &= stella_object_to_nat(n) == 20000 + round;
+    }
+    stella_object *n = live;
+    gc_push_root((void **) &n);
+    for (int i = 0; i < 100000 * scale; i++) {
+        n = stella_object_succ(n);
+    }
+    ok &= stella_object_to_nat(n) == 50000 + 100000 * scale;
+    ok &= stella_object_to_nat(live) == 50000;
+    gc_pop_root((void **) &n);
+    gc_pop_root((void **) &live);
+    return ok;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(int scale);
+} workloads[] = {
+        {"lists", run_lists},
+        {"trees", run_trees},
+        {"refs",  run_refs},
+        {"succ",  run_succ},
+};
+
+static void report_line(const char *workload, const char *metric, const char *format, ...)
+        __attribute__((format(printf, 3, 4)));
+
+static void report_line(const char *workload, const char *metric, const char *format, ...) {
+    char key[64], value[64];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(value, sizeof value, format, args);
+    va_end(args);
+    snprintf(key, sizeof key, "%s.%s", workload, metric);
+    printf("%-32s %s\n", key, value);
+}
+
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+/** Percentile of the pauses of all kinds, in microseconds (upper bound of the histogram bucket). */
+static double pause_percentile_us(const gc_histogram *pauses, double p) {
+    size_t count = 0;
+    uint64_t max_ns = 0;
+    for (int kind = 0; kind < GC_PAUSE_KINDS; kind++) {
+        count += pauses[kind].count;
+        max_ns = MAX(max_ns, pauses[kind].max_ns);
+    }
+    size_t rank = (size_t) (p * (double) count), seen = 0;
+    for (int bucket = 0; bucket < GC_HISTOGRAM_BUCKETS; bucket++) {
+        for (int kind = 0; kind < GC_PAUSE_KINDS; kind++) {
+            seen += pauses[kind].buckets[bucket];
+        }
+        if (seen > rank) {
+            return (double) MIN((uint64_t) 2 << bucket, max_ns) / 1e3;
+        }
+    }
+    return (double) max_ns / 1e3;
+}
+#endif
+
+static void run(int i, int scale) {
+    const char *name = workloads[i].name;
+    uint64_t start = now_ns();
+    int ok = workloads[i].run(scale);
+    uint64_t wall = now_ns() - start;
+
+    report_line(name, "check", "%s", ok ? "ok" : "FAILED");
+    report_line(name, "wall_ms", "%.3f", (double) wall / 1e6);
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    gc_update_stats();
+    const gc_stats *stats = gc_current_stats();
+    size_t pauses = 0;
+    for (int kind = 0; kind < GC_PAUSE_KINDS; kind++) {
+        pauses += stats->pauses[kind].count;
+    }
+    report_line(name, "allocated_bytes", "%zu", stats->total_allocated_bytes);
+    report_line(name, "alloc_mb_per_s", "%.1f", (double) stats->total_allocated_bytes / 1e6 / ((double) wall / 1e9));
+    report_line(name, "gc_ms", "%.3f", (double) stats->gc_ns / 1e6);
+    report_line(name, "gc_cycles", "%zu", stats->gc_cycles);
+    report_line(name, "minor_gc_cycles", "%zu", stats->minor_gc_cycles);
+    report_line(name, "pauses", "%zu", pauses);
+    report_line(name, "pause_p50_us", "%.1f", pause_percentile_us(stats->pauses, 0.50));
+    report_line(name, "pause_p90_us", "%.1f", pause_percentile_us(stats->pauses, 0.90));
+    report_line(name, "pause_p99_us", "%.1f", pause_percentile_us(stats->pauses, 0.99));
+    report_line(name, "pause_max_us", "%.1f", pause_percentile_us(stats->pauses, 1.0));
+    report_line(name, "peak_residency_bytes", "%zu", stats->maximum_residency_bytes);
+    report_line(name, "peak_heap_bytes", "%zu", stats->peak_heap_size);
+#endif
+}
+
+int main(int argc, char **argv) {
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+    if (scale < 1) {
+        scale = 1;
+    }
+
+#ifdef STELLA_GC_BACKEND_INCREMENTAL
+    const char *collector = "incremental";
+#elif defined(STELLA_GC_BACKEND_CHENEY)
+    const char *collector = "cheney";
+#else
+    const char *collector = "compact";
+#endif
+#ifdef STELLA_GC_GENERATIONAL
+    const char *generational = "yes";
+#else
+    const char *generational = "no";
+#endif
+#ifdef STELLA_IMMEDIATE_NATS
+    const char *immediate_nats = "yes";
+#else
+    const char *immediate_nats = "no";
+#endif
+#ifdef STELLA_COMPRESSED_REFS
+    const char *compressed_refs = "yes";
+#else
+    const char *compressed_refs = "no";
+#endif
+    printf("# stella_gc_bench scale=%d collector=%s generational=%s immediate_nats=%s compressed_refs=%s"
+           " stats_level=%d\n", scale, collector, generational, immediate_nats, compressed_refs, STELLA_GC_STATS_LEVEL);
+#if STELLA_GC_STATS_LEVEL < STELLA_GC_STATS_CHEAP
+    printf("# statistics are off (STELLA_GC_STATS_LEVEL): only the wall time is reported\n");
+#endif
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof workloads / sizeof workloads[0]; i++) {
+        int selected = argc <= 2;
+        for (int arg = 2; arg < argc; arg++) {
+            selected |= !strcmp(argv[arg], workloads[i].name);
+        }
+        if (!selected) {
+            continue;
+        }
+
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            run((int) i, scale);
+            exit(0);
+        }
+        int status;
+        waitpid(child, &status, 0);
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    return failed;
+}
@@ -0,0 +1,295 @@
+//
+// Closure-heavy programs written the way the Stella compiler generates them, timing the shadow stack
+// of roots against the conservative scan of the native stack (STELLA_GC_CONSERVATIVE): in a conservative
+// build the locals are not registered at all. Every workload runs in its own child process and reports
+// "workload.metric value" lines, so that the runs of the two builds can be put side by side
+// (see bench_roots.sh at the top of the repository).
+// Usage: stella_gc_roots_bench [scale] [workload...]   (workloads: arith compose map, default all)
+//
+
+#define _DEFAULT_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+#ifdef STELLA_GC_CONSERVATIVE
+#define ROOT(variable) ((void) 0)
+#define UNROOT(variable) ((void) 0)
+#else
+#define ROOT(variable) gc_push_root((void **) &(variable))
+#define UNROOT(variable) gc_pop_root((void **) &(variable))
+#endif
+
+#define CALL(f, x) STELLA_OBJECT_CLOSURE_CALL(f, x)
+#define CAPTURED(self, i) STELLA_OBJECT_READ_FIELD(self, i)
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/** A closure of code with up to two captured values. */
+static stella_object *closure(void *code, int captures, stella_object *first, stella_object *second) {
+    ROOT(first);
+    ROOT(second);
+    stella_object *c = alloc_stella_object(TAG_FN, 1 + captures);
+    STELLA_OBJECT_INIT_FIELD(c, 0, code);
+    if (captures > 0) {
+        STELLA_OBJECT_INIT_FIELD(c, 1, first);
+    }
+    if (captures > 1) {
+        STELLA_OBJECT_INIT_FIELD(c, 2, second);
+    }
+    UNROOT(second);
+    UNROOT(first);
+    return c;
+}
+
+static stella_object *cons(stella_object *head, stella_object *tail) {
+    ROOT(head);
+    ROOT(tail);
+    stella_object *c = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(c, 0, head);
+    STELLA_OBJECT_INIT_FIELD(c, 1, tail);
+    UNROOT(tail);
+    UNROOT(head);
+    return c;
+}
+
+/* fn(acc) { return succ(acc) } */
+static stella_object *add_step(stella_object *self, stella_object *acc) {
+    (void) self;
+    return stella_object_succ(acc);
+}
+
+/* fn(i) { return fn(acc) { return succ(acc) } } */
+static stella_object *add_steps(stella_object *self, stella_object *i) {
+    (void) self;
+    (void) i;
+    return closure((void *) add_step, 0, NULL, NULL);
+}
+
+/* fn(n) { return fn(m) { return Nat::rec(n, m, fn(i) { ... }) } }, applied to both arguments */
+static stella_object *add(stella_object *n, stella_object *m) {
+    ROOT(n);
+    ROOT(m);
+    stella_object *f = closure((void *) add_steps, 0, NULL, NULL);
+    stella_object *result = stella_object_nat_rec(n, m, f);
+    UNROOT(m);
+    UNROOT(n);
+    return result;
+}
+
+/* fn(acc) { return add(m)(acc) }, m captured */
+static stella_object *mul_step(stella_object *self, stella_object *acc) {
+    return add(CAPTURED(self, 1), acc);
+}
+
+/* fn(i) { return fn(acc) { return add(m)(acc) } }, m captured */
+static stella_object *mul_steps(stella_object *self, stella_object *i) {
+    (void) i;
+    return closure((void *) mul_step, 1, CAPTURED(self, 1), NULL);
+}
+
+static stella_object *mul(stella_object *n, stella_object *m) {
+    ROOT(n);
+    ROOT(m);
+    stella_object *f = closure((void *) mul_steps, 1, m, NULL);
+    stella_object *result = stella_object_nat_rec(n, &the_ZERO, f);
+    UNROOT(m);
+    UNROOT(n);
+    return result;
+}
+
+/** Church-style arithmetic: products computed by Nat::rec over closures which add by Nat::rec. */
+static int run_arith(int scale) {
+    int ok = 1;
+    for (int round = 0; round < 300 * scale; round++) {
+        int k = 50 + round % 20;
+        stella_object *n = nat_to_stella_object(k);
+        ROOT(n);
+        stella_object *product = mul(n, n);
+        UNROOT(n);
+        ok &= stella_object_to_nat(product) == k * k;
+    }
+    return ok;
+}
+
+/* fn(x) { return succ(x) } */
+static stella_object *increment(stella_object *self, stella_object *x) {
+    (void) self;
+    return stella_object_succ(x);
+}
+
+/* fn(x) { return f(g(x)) }, f and g captured */
+static stella_object *composed(stella_object *self, stella_object *x) {
+    stella_object *f = CAPTURED(self, 1);
+    ROOT(f);
+    x = CALL(CAPTURED(self, 2), x);
+    x = CALL(f, x);
+    UNROOT(f);
+    return x;
+}
+
+#define COMPOSED_FUNCTIONS 1000
+
+/** Long chains of composed closures, built and applied (deep native stacks). */
+static int run_compose(int scale) {
+    int ok = 1;
+    for (int round = 0; round < 200 * scale; round++) {
+        stella_object *f = closure((void *) increment, 0, NULL, NULL), *g = NULL;
+        ROOT(f);
+        ROOT(g);
+        for (int i = 1; i < COMPOSED_FUNCTIONS; i++) {
+            g = closure((void *) increment, 0, NULL, NULL);
+            f = closure((void *) composed, 2, f, g);
+        }
+        stella_object *result = CALL(f, nat_to_stella_object(round));
+        UNROOT(g);
+        UNROOT(f);
+        ok &= stella_object_to_nat(result) == round + COMPOSED_FUNCTIONS;
+    }
+    return ok;
+}
+
+/* fn(x) { return add(x)(k) }, k captured */
+static stella_object *add_k(stella_object *self, stella_object *x) {
+    return add(x, CAPTURED(self, 1));
+}
+
+/* map(f, list), not tail recursive */
+static stella_object *map(stella_object *f, stella_object *list) {
+    if (STELLA_OBJECT_HEADER_TAG(list->object_header) != TAG_CONS) {
+        return &the_EMPTY;
+    }
+    stella_object *head = NULL;
+    ROOT(f);
+    ROOT(list);
+    ROOT(head);
+    head = CALL(f, STELLA_OBJECT_READ_FIELD(list, 0));
+    stella_object *tail = map(f, STELLA_OBJECT_READ_FIELD(list, 1));
+    stella_object *result = cons(head, tail);
+    UNROOT(head);
+    UNROOT(list);
+    UNROOT(f);
+    return result;
+}
+
+#define MAPPED_LENGTH 1000
+
+/** A list mapped over and over with a closure, every pass building a new list. */
+static int run_map(int scale) {
+    int ok = 1;
+    stella_object *list = &the_EMPTY, *f = NULL;
+    ROOT(list);
+    ROOT(f);
+    for (int i = 0; i < MAPPED_LENGTH; i++) {
+        list = cons(nat_to_stella_object(i % 100), list);
+    }
+    f = closure((void *) add_k, 1, nat_to_stella_object(3), NULL);
+    long expected = 0;
+    for (int i = 0; i < MAPPED_LENGTH; i++) {
+        expected += i % 100;
+    }
+    for (int pass = 0; pass < 100 * scale; pass++) {
+        list = map(f, list);
+        expected += 3 * MAPPED_LENGTH;
+    }
+    long sum = 0;
+    for (stella_object *cell = list; STELLA_OBJECT_HEADER_TAG(cell->object_header) == TAG_CONS;
+         cell = STELLA_OBJECT_READ_FIELD(cell, 1)) {
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(cell, 0));
+    }
+    ok &= sum == expected;
+    UNROOT(f);
+    UNROOT(list);
+    return ok;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(int scale);
+} workloads[] = {
+        {"arith",   run_arith},
+        {"compose", run_compose},
+        {"map",     run_map},
+};
+
+static void report_line(const char *workload, const char *metric, const char *format, ...)
+        __attribute__((format(printf, 3, 4)));
+
+static void report_line(const char *workload, const char *metric, const char *format, ...) {
+    char key[64], value[64];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(value, sizeof value, format, args);
+    va_end(args);
+    snprintf(key, sizeof key, "%s.%s", workload, metric);
+    printf("%-32s %s\n", key, value);
+}
+
+static void run(int i, int scale) {
+    const char *name = workloads[i].name;
+    uint64_t start = now_ns();
+    int ok = workloads[i].run(scale);
+    uint64_t wall = now_ns() - start;
+
+    report_line(name, "check", "%s", ok ? "ok" : "FAILED");
+    report_line(name, "wall_ms", "%.3f", (double) wall / 1e6);
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    gc_update_stats();
+    const gc_stats *stats = gc_current_stats();
+    report_line(name, "allocated_bytes", "%zu", stats->total_allocated_bytes);
+    report_line(name, "gc_ms", "%.3f", (double) stats->gc_ns / 1e6);
+    report_line(name, "root_ms", "%.3f", (double) stats->root_forwarding_ns / 1e6);
+    report_line(name, "gc_cycles", "%zu", stats->gc_cycles);
+    report_line(name, "ambiguous_roots", "%zu", stats->ambiguous_roots);
+    report_line(name, "pinned_bytes", "%zu", stats->pinned_bytes);
+    report_line(name, "peak_heap_bytes", "%zu", stats->peak_heap_size);
+#endif
+}
+
+int main(int argc, char **argv) {
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+    if (scale < 1) {
+        scale = 1;
+    }
+
+#ifdef STELLA_GC_CONSERVATIVE
+    const char *roots = "conservative";
+#else
+    const char *roots = "shadow";
+#endif
+    printf("# stella_gc_roots_bench scale=%d roots=%s stats_level=%d\n", scale, roots, STELLA_GC_STATS_LEVEL);
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof workloads / sizeof workloads[0]; i++) {
+        int selected = argc <= 2;
+        for (int arg = 2; arg < argc; arg++) {
+            selected |= !strcmp(argv[arg], workloads[i].name);
+        }
+        if (!selected) {
+            continue;
+        }
+
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            run((int) i, scale);
+            exit(0);
+        }
+        int status;
+        waitpid(child, &status, 0);
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    return failed;
+}
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 
@@ -19,29 +20,482 @@
 #define FROM_SPACE_SIZE MAX_ALLOC_SIZE
 #define TO_SPACE_SIZE MAX_ALLOC_SIZE
 
+/** Upper bound for the size of a semispace. The heap grows up to this size before running out of memory. */
+#ifndef MAX_HEAP_SIZE
+#define MAX_HEAP_SIZE 1024*1024*1024
+#endif
+
+/** Target ratio of the semispace size to the live data after a collection (cf. GHC's -F). */
+#ifndef HEAP_OCCUPANCY_FACTOR
+#define HEAP_OCCUPANCY_FACTOR 2.0
+#endif
+
+/** Bytes the incremental collector scans per allocated byte (at least). */
+#ifndef GC_WORK_RATIO
+#define GC_WORK_RATIO 1.0
+#endif
+
+/** Time budget of one incremental step in microseconds (0 means unlimited). */
+#ifndef GC_STEP_BUDGET_US
+#define GC_STEP_BUDGET_US 0
+#endif
+
+/** Bytes scanned between two checks of the step time budget. */
+#define GC_PACING_CHUNK 4096
+
+/** What happens to the pages of a semispace once it is evacuated (see enum GC_RELEASE_POLICY).
+ * STELLA_GC_RELEASE (none, lazy or eager) overrides it at run time.
+ */
+#ifndef GC_DEFAULT_RELEASE
+#define GC_DEFAULT_RELEASE GC_RELEASE_LAZY
+#endif
+
+/** Pages backing the semispaces and the nursery (see enum GC_PAGE_KIND).
+ * STELLA_GC_HUGE_PAGES (off, thp or hugetlb) overrides it at run time.
+ */
+#ifndef GC_DEFAULT_PAGES
+#define GC_DEFAULT_PAGES GC_PAGES_REGULAR
+#endif
+
+/** Order in which the copying backends evacuate from-space (see enum GC_COPY_ORDER).
+ * STELLA_GC_COPY_ORDER (breadth, chase or depth) overrides it at run time.
+ */
+#ifndef GC_DEFAULT_COPY_ORDER
+#ifdef STELLA_GC_BACKEND_INCREMENTAL
+#define GC_DEFAULT_COPY_ORDER GC_COPY_CHASE
+#else
+#define GC_DEFAULT_COPY_ORDER GC_COPY_BREADTH
+#endif
+#endif
+
+/** Objects pending for the depth-first copy order; children beyond it are left to the scan. */
+#define GC_COPY_STACK_SIZE 64
+
+/** The scan prefetches the from-space children of the object this many objects ahead of it
+ * (0 disables prefetching). STELLA_GC_PREFETCH overrides it at run time.
+ */
+#ifndef GC_PREFETCH_DISTANCE
+#define GC_PREFETCH_DISTANCE 4
+#endif
+
+/** Size of an explicit huge page (GC_PAGES_HUGETLB): the spaces are rounded up to it. */
+#ifndef GC_HUGE_PAGE_SIZE
+#define GC_HUGE_PAGE_SIZE 2*1024*1024
+#endif
+
+/** With STELLA_COMPRESSED_REFS, the heap spaces are reserved from this many bytes above the program break
+ * (which follows the static data, at a random distance) to the end of the 4 GiB the references reach:
+ * the gap is left for malloc to grow the break into.
+ */
+#ifndef GC_COMPRESSED_HEAP_GAP
+#define GC_COMPRESSED_HEAP_GAP 256*1024*1024
+#endif
+
+/** Size of the nursery used by the generational mode (STELLA_GC_GENERATIONAL).
+ * Objects larger than the nursery are allocated directly in the old generation.
+ */
+#ifndef NURSERY_SIZE
+#define NURSERY_SIZE 64*1024
+#endif
+
+#define REMEMBERED_SET_INITIAL_CAPACITY 256
+
+/** Objects of at least this many bytes are allocated in the large object space:
+ * they are never moved, but marked during a cycle and freed at the flip when unmarked.
+ */
+#ifndef LARGE_OBJECT_SIZE
+#define LARGE_OBJECT_SIZE 4096
+#endif
+
+#define LARGE_OBJECTS_INITIAL_CAPACITY 64
+
+/** Upper bound for the number of threads of the parallel evacuation (STELLA_GC_PARALLEL).
+ * The number actually used is read from STELLA_GC_THREADS and defaults to the number of online CPUs.
+ */
+#ifndef GC_MAX_WORKERS
+#define GC_MAX_WORKERS 16
+#endif
+
+/** Bytes a worker claims from to-space at a time for copying (its copy buffer). */
+#ifndef GC_PARALLEL_CHUNK_SIZE
+#define GC_PARALLEL_CHUNK_SIZE 32*1024
+#endif
+
+/** Smaller heaps are evacuated by the collecting thread alone. */
+#ifndef GC_PARALLEL_MIN_HEAP
+#define GC_PARALLEL_MIN_HEAP 1024*1024
+#endif
+
+#define GC_DEQUE_INITIAL_CAPACITY 1024
+
+/** Bytes a mutator thread claims from from-space at a time for its allocations (STELLA_GC_MULTI_MUTATOR). */
+#ifndef GC_TLAB_SIZE
+#define GC_TLAB_SIZE 16*1024
+#endif
+
+/** Header bit of an object that has already been evacuated (copied to to-space or promoted).
+ * The first field of such an object holds the address of its copy.
+ */
+#define GC_HEADER_FORWARDED (1 << 8)
+/** Header bit of an old generation object that is already in the remembered set. */
+#define GC_HEADER_REMEMBERED (1 << 9)
+/** Header bit of a heap object reached in the current mark-compact cycle,
+ * or pinned in place by the current conservative cycle (STELLA_GC_CONSERVATIVE).
+ */
+#define GC_HEADER_MARKED (1 << 10)
+/** Header bit of an object being copied by a parallel worker; GC_HEADER_FORWARDED replaces it once the copy is done. */
+#define GC_HEADER_BUSY (1 << 11)
+
+#ifdef STELLA_GC_PROFILE
+/** With STELLA_GC_PROFILE, header bits GC_HEADER_AGE_SHIFT and up hold the age of an object:
+ * the number of collections it survived, up to GC_MAX_AGE (see STELLA_MAX_FIELDS).
+ */
+#define GC_HEADER_AGE_SHIFT 27
+#define GC_MAX_AGE 15
+#define GC_HEADER_AGE(header) (((header) >> GC_HEADER_AGE_SHIFT) & GC_MAX_AGE)
+#endif
+
+/** The collector backend is selected at build time (see the STELLA_GC_BACKEND CMake option):
+ * STELLA_GC_BACKEND_INCREMENTAL interleaves a Baker-style cycle with allocation,
+ * STELLA_GC_BACKEND_CHENEY copies the whole live heap in one stop-the-world Cheney pass,
+ * STELLA_GC_BACKEND_COMPACT marks the live heap and slides it in place, needing no second semispace.
+ */
+#if !defined(STELLA_GC_BACKEND_INCREMENTAL) && !defined(STELLA_GC_BACKEND_CHENEY) \
+    && !defined(STELLA_GC_BACKEND_COMPACT)
+#define STELLA_GC_BACKEND_INCREMENTAL
+#endif
+
+#if defined(STELLA_GC_BACKEND_COMPACT) && defined(STELLA_GC_GENERATIONAL)
+#error "The generational mode needs a copying backend (incremental or cheney)"
+#endif
+
+/** Parallel evacuation (STELLA_GC_PARALLEL) splits stop-the-world Cheney collections between worker threads.
+ * Their copy buffers leave gaps in to-space, which is then not walkable object by object:
+ * the backends and modes which walk the spaces linearly are excluded.
+ */
+#if defined(STELLA_GC_PARALLEL) && (!defined(STELLA_GC_BACKEND_CHENEY) || defined(STELLA_GC_GENERATIONAL))
+#error "STELLA_GC_PARALLEL needs the non-generational cheney backend"
+#endif
+
+/** Only the incremental collector lets the mutator run while a cycle is in progress,
+ * so only it needs the read barrier. Generational major collections run to completion:
+ * with STELLA_GC_BACKEND_INCREMENTAL the generational mode collects the old generation
+ * stop-the-world, and the read barrier is compiled out.
+ */
+#if defined(STELLA_GC_BACKEND_INCREMENTAL) && !defined(STELLA_GC_GENERATIONAL)
+#define STELLA_GC_READ_BARRIER
+#endif
+
+/** The generational mode records old-to-young pointers with the write barrier. */
+#ifdef STELLA_GC_GENERATIONAL
+#define STELLA_GC_WRITE_BARRIER
+#endif
+
+/** Field accesses carry no barrier where the collector needs none (the stop-the-world backends
+ * without the generational mode). STELLA_GC_KEEP_BARRIERS (STELLA_GC_ELIDE_BARRIERS=OFF) compiles
+ * both of them in anyway, e.g. to count accesses or compare the cost of the barriers; their slow
+ * paths are then never taken.
+ */
+#ifdef STELLA_GC_KEEP_BARRIERS
+#ifndef STELLA_GC_READ_BARRIER
+#define STELLA_GC_READ_BARRIER
+#endif
+#ifndef STELLA_GC_WRITE_BARRIER
+#define STELLA_GC_WRITE_BARRIER
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GC_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define GC_UNLIKELY(x) (x)
+#endif
+
 /** This macro is used whenever the runtime wants to READ a heap object's field.
  */
-#define GC_READ_BARRIER(object, field_index, read_code) (void *)(gc_read_barrier(object, field_index), read_code) // NO BARRIER
+#ifdef STELLA_GC_READ_BARRIER
+#define GC_READ_BARRIER(object, field_index, read_code) (void *)(gc_read_barrier_fast(object, field_index), read_code)
+#else
+#define GC_READ_BARRIER(object, field_index, read_code) (void *)(read_code) // NO BARRIER
+#endif
 /** This macro is used whenever the runtime wants to OVERWRITE a heap object's field.
  * This is NOT used when initializing object fields.
  */
-#define GC_WRITE_BARRIER(object, field_index, contents, write_code) (gc_write_barrier(object, field_index, contents), write_code) // NO BARRIER
+#ifdef STELLA_GC_WRITE_BARRIER
+#define GC_WRITE_BARRIER(object, field_index, contents, write_code) (gc_write_barrier_fast(object, field_index, contents), write_code)
+#else
+#define GC_WRITE_BARRIER(object, field_index, contents, write_code) (write_code) // NO BARRIER
+#endif
+
+#define GC_OBJ_SIZE(obj) (sizeof(stella_object) + STELLA_OBJECT_HEADER_FIELD_COUNT((obj)->object_header) * sizeof(stella_field))
+
+/** Every heap object has room for at least one field, which holds the forwarding address once it is evacuated. */
+#define GC_MIN_OBJ_SIZE (sizeof(stella_object) + sizeof(stella_field))
+/** Size of an object as laid out on the heap. */
+#define GC_HEAP_OBJ_SIZE(obj) MAX(GC_OBJ_SIZE(obj), GC_MIN_OBJ_SIZE)
+
+#define ROOT_STACK_INITIAL_CAPACITY 1024
+
+/** Levels of GC statistics (see the STELLA_GC_STATS_LEVEL CMake option):
+ * OFF collects nothing, CHEAP keeps per-cycle aggregates (cycles, heap sizing, allocated and
+ * promoted bytes, timings and pause histograms), FULL also counts every read, write, barrier hit
+ * and allocated object, and times every incremental step. Only FULL adds work to the mutator fast path:
+ * with CHEAP the incremental collector times the flips which start its cycles, not the steps in between.
+ */
+#define STELLA_GC_STATS_OFF 0
+#define STELLA_GC_STATS_CHEAP 1
+#define STELLA_GC_STATS_FULL 2
+
+#ifndef STELLA_GC_STATS_LEVEL
+#define STELLA_GC_STATS_LEVEL STELLA_GC_STATS_CHEAP
+#endif
+
+/** Statements that update per-access counters (FULL level only). */
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_FULL
+#define GC_STATS_FULL(...) __VA_ARGS__
+#else
+#define GC_STATS_FULL(...)
+#endif
+/** Statements that update per-cycle aggregates (CHEAP and FULL levels). */
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+#define GC_STATS_CYCLE(...) __VA_ARGS__
+#else
+#define GC_STATS_CYCLE(...)
+#endif
+
+/** Several mutator threads (STELLA_GC_MULTI_MUTATOR) share a stop-the-world Cheney heap.
+ * The per-access counters of the FULL statistics level would be updated by all of them at once.
+ */
+#if defined(STELLA_GC_MULTI_MUTATOR) \
+    && (!defined(STELLA_GC_BACKEND_CHENEY) || defined(STELLA_GC_GENERATIONAL) || STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_FULL)
+#error "STELLA_GC_MULTI_MUTATOR needs the non-generational cheney backend and at most cheap statistics"
+#endif
+
+/** Explicit heap contexts (STELLA_GC_CONTEXTS) give every heap its own state; the mutator threads
+ * of STELLA_GC_MULTI_MUTATOR share a single one.
+ */
+#if defined(STELLA_GC_CONTEXTS) && defined(STELLA_GC_MULTI_MUTATOR)
+#error "STELLA_GC_CONTEXTS cannot be combined with STELLA_GC_MULTI_MUTATOR"
+#endif
+
+/** The conservative mode (STELLA_GC_CONSERVATIVE) scans the native stack of a single mutator thread
+ * for ambiguous roots in stop-the-world Cheney collections.
+ */
+#if defined(STELLA_GC_CONSERVATIVE) && (!defined(STELLA_GC_BACKEND_CHENEY) || defined(STELLA_GC_GENERATIONAL) \
+    || defined(STELLA_GC_PARALLEL) || defined(STELLA_GC_MULTI_MUTATOR) || defined(STELLA_GC_CONTEXTS))
+#error "STELLA_GC_CONSERVATIVE needs the cheney backend without STELLA_GC_GENERATIONAL, STELLA_GC_PARALLEL, STELLA_GC_MULTI_MUTATOR and STELLA_GC_CONTEXTS"
+#endif
+
+/** Compressed references (STELLA_COMPRESSED_REFS, see stella_field) need every heap space in the 4 GiB
+ * above STELLA_HEAP_BASE, which a single heap carves out of one reservation. The mark-compact backend
+ * keeps its forwarding offsets in the padding after the header, which this layout does not have,
+ * and the conservative mode unmaps parts of the spaces.
+ */
+#if defined(STELLA_COMPRESSED_REFS) && (defined(STELLA_GC_BACKEND_COMPACT) || defined(STELLA_GC_CONSERVATIVE) \
+    || defined(STELLA_GC_MULTI_MUTATOR) || defined(STELLA_GC_CONTEXTS))
+#error "STELLA_COMPRESSED_REFS needs a copying backend without STELLA_GC_CONSERVATIVE, STELLA_GC_MULTI_MUTATOR and STELLA_GC_CONTEXTS"
+#endif
+
+/** The heap profile (STELLA_GC_PROFILE) is updated without synchronization, by one thread at a time. */
+#if defined(STELLA_GC_PROFILE) && (defined(STELLA_GC_PARALLEL) || defined(STELLA_GC_MULTI_MUTATOR))
+#error "STELLA_GC_PROFILE cannot be combined with STELLA_GC_PARALLEL or STELLA_GC_MULTI_MUTATOR"
+#endif
+
+/** File the heap profile is written to, unless STELLA_GC_PROFILE_FILE names another one. */
+#ifndef GC_PROFILE_FILE
+#define GC_PROFILE_FILE "stella-gc-profile.tsv"
+#endif
+
+/** Tags told apart by the heap profile (every value of the TAG bits). */
+#define GC_PROFILE_TAGS 16
+/** Size classes of the allocation profile, by fields count: 1, 2, 3-4, 5-8, ..., 33-64, 65 and more. */
+#define GC_PROFILE_SIZE_CLASSES 8
+
+/** File the event trace is written to at exit (STELLA_GC_TRACE), unless STELLA_GC_TRACE_FILE names another one. */
+#ifndef GC_TRACE_FILE
+#define GC_TRACE_FILE "stella-gc-trace.json"
+#endif
+
+/** Capacity of the event trace ring buffer, unless STELLA_GC_TRACE_EVENTS sets another one:
+ * once it is full, every event overwrites the oldest.
+ */
+#ifndef GC_TRACE_EVENTS
+#define GC_TRACE_EVENTS 65536
+#endif
+
+/** Number of buckets in a gc_histogram. */
+#define GC_HISTOGRAM_BUCKETS 48
+
+/** Log-bucketed histogram of durations: bucket i counts durations in [2^i, 2^(i+1)) nanoseconds. */
+typedef struct Gc_histogram {
+    size_t buckets[GC_HISTOGRAM_BUCKETS];
+    size_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} gc_histogram;
+
+/** Kinds of mutator pauses. */
+enum GC_PAUSE_KIND {
+    GC_PAUSE_STEP,   /**< One incremental step (scanning interleaved with an allocation), only flips below FULL. */
+    GC_PAUSE_MINOR,  /**< Nursery collection. */
+    GC_PAUSE_FULL,   /**< Complete collection (stop-the-world or major). */
+    GC_PAUSE_KINDS
+};
+
+/** Collector events, recorded in the trace ring buffer with STELLA_GC_TRACE.
+ * With STELLA_GC_USDT the same events are static probes of the stella_gc provider, nops until a tracer
+ * attaches to them (bpftrace -e 'usdt:./program:stella_gc:step__done { @[arg0] = count(); }'):
+ * cycle__start(heap bytes), cycle__done(live bytes, heap bytes), minor__start, minor__done(promoted bytes),
+ * roots__start, roots__done(roots), step__start(allocated bytes), step__done(scanned bytes),
+ * finish__start, finish__done(scanned bytes), flip(live bytes, target heap bytes),
+ * heap__resize(old heap bytes, new heap bytes) and out__of__memory(heap bytes, heap limit).
+ */
+enum GC_TRACE_KIND {
+    GC_TRACE_CYCLE,     /**< A major cycle, from its start to the flip (incremental steps run inside it). */
+    GC_TRACE_MINOR,     /**< A nursery collection. */
+    GC_TRACE_ROOTS,     /**< Forwarding (or marking, or pinning) the roots. */
+    GC_TRACE_STEP,      /**< One incremental scan step, before an allocation. */
+    GC_TRACE_FINISH,    /**< Scanning the rest of a cycle without interleaving it with allocation. */
+    GC_TRACE_FLIP,      /**< To-space becomes from-space. */
+    GC_TRACE_RESIZE,    /**< The heap grows or shrinks. */
+    GC_TRACE_OOM,       /**< The heap limit is reached. */
+    GC_TRACE_KINDS
+};
+
+#ifdef STELLA_GC_TRACE
+/** An entry of the trace ring buffer. Instant events (flip, resize, out of memory) have no duration. */
+typedef struct Gc_trace_event {
+    uint64_t start_ns;      /**< CLOCK_MONOTONIC, as the timestamps of the application. */
+    uint64_t duration_ns;
+    uint64_t args[2];       /**< Meaning depends on the kind (see the probes of GC_TRACE_KIND). */
+    uint32_t kind;
+    uint32_t thread;
+} gc_trace_event;
+#endif
 
-#define GC_OBJ_SIZE(obj) sizeof(stella_object) + STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header) * sizeof(void *)
+/** Policies for returning the pages of an evacuated semispace to the OS. */
+enum GC_RELEASE_POLICY {
+    GC_RELEASE_NONE,    /**< Keep them: no page faults when the space is reused, but it stays in RSS. */
+    GC_RELEASE_LAZY,    /**< MADV_FREE: the kernel takes them back under memory pressure only. */
+    GC_RELEASE_EAGER,   /**< MADV_DONTNEED: out of RSS at once, faulted in again by the next cycle. */
+};
 
-typedef struct Gc_root {
-    struct Gc_root *next, *prev;
-    void **content;
-} gc_root;
+/** Pages backing the heap spaces. */
+enum GC_PAGE_KIND {
+    GC_PAGES_REGULAR,
+    GC_PAGES_THP,       /**< Regular mappings advised to use transparent huge pages (MADV_HUGEPAGE). */
+    GC_PAGES_HUGETLB,   /**< MAP_HUGETLB, falling back to regular pages if none are reserved. */
+};
+
+/** Evacuation orders of the copying backends (the parallel evacuation has its own). */
+enum GC_COPY_ORDER {
+    GC_COPY_BREADTH,    /**< Cheney: the scan copies the children of an object after everything copied before it. */
+    GC_COPY_CHASE,      /**< Follow the last not yet copied child (the tail of a list) from every copied object. */
+    GC_COPY_DEPTH,      /**< Depth first: an object is followed by its first child and that child's descendants. */
+};
+
+/** A slot of the shadow stack: the address of a variable holding a heap reference. */
+typedef void **gc_root;
+
+/** An object of the large object space. The mark is kept here rather than in the object header,
+ * which the mutator initializes after allocation.
+ */
+typedef struct Gc_large_object {
+    void *address;
+    size_t size;
+    bool marked;    /**< Reached in the current cycle (or allocated during it). */
+} gc_large_object;
+
+/** A heap image mapped by gc_load_snapshot. */
+typedef struct Gc_snapshot {
+    void *address;
+    size_t size;
+} gc_snapshot;
+
+/** Free address space of the reservation holding the heap spaces (STELLA_COMPRESSED_REFS). */
+typedef struct Gc_free_range {
+    void *address;
+    size_t size;
+} gc_free_range;
+
+/** Objects kept in place by the conservative mode (STELLA_GC_CONSERVATIVE): adjacent objects [first, end)
+ * of an evacuated space, which start on pages an ambiguous root pointed into. Only the pages holding them
+ * ([pages, pages + pages_size)) stay mapped.
+ */
+typedef struct Gc_pinned_run {
+    void *first, *end;
+    void *pages;
+    size_t pages_size;
+} gc_pinned_run;
+
+/** Work done by one thread of the parallel evacuation, summed over all cycles. */
+typedef struct Gc_worker_stats {
+    size_t copied_bytes;
+    size_t copied;
+    size_t scanned;     /**< Objects whose fields the worker forwarded. */
+    size_t steals;      /**< Objects taken from the deques of other workers. */
+} gc_worker_stats;
 
 typedef struct Gc_state {
     void *from_space, *to_space;
     size_t from_space_size, to_space_size;
     void *scan, *next, *limit;
-    gc_root *roots_list;
-    gc_root *roots_last;
-    size_t roots_size;
+    gc_root *roots;
+    size_t roots_size, roots_capacity;
     bool gc_running;
+    bool stop_requested;             /**< A collection waits for the mutator threads to stop. */
+    bool parallel_cycle;             /**< The current cycle is evacuated by all workers (STELLA_GC_PARALLEL). */
+    void *nursery;
+    size_t nursery_size;
+    void *nursery_next, *nursery_limit;
+    void **remembered_set;
+    size_t remembered_size, remembered_capacity;
+    void *tenured_start;             /**< Start of the objects allocated in the old generation since the last minor collection. */
+    void **tenured_large;            /**< The large objects allocated since the last minor collection. */
+    size_t tenured_large_size, tenured_large_capacity;
+    size_t heap_initial_size, heap_max_size;
+    double heap_occupancy;
+    size_t heap_target_size;
+    size_t evacuation_reserve;
+    size_t headroom;                 /**< Free bytes the current cycle has to leave after the flip. */
+    size_t hidden_bytes;             /**< Free bytes above limit, hidden by a flip which shrank the heap. */
+    size_t live_at_flip;             /**< Bytes left in from-space by the last flip (0 before the first one). */
+    double work_ratio;
+    unsigned long step_budget_us;
+    int pause_depth;
+    enum GC_PAUSE_KIND pause_kind;
+    uint64_t pause_start_ns;
+    void *alloc_mark;
+    size_t allocated_at_flip;
+    gc_large_object *large_objects;  /**< Sorted by address. */
+    size_t large_objects_size, large_objects_capacity;
+    size_t large_objects_bytes;
+    size_t large_allocated_since_flip;
+    void **gray_objects;             /**< Marked objects whose fields are not scanned yet. */
+    size_t gray_size, gray_capacity;
+    gc_snapshot *snapshots;          /**< Mapped heap images: immortal, never scanned. */
+    size_t snapshots_size, snapshots_capacity;
+    enum GC_RELEASE_POLICY release_policy;
+    enum GC_PAGE_KIND page_kind;
+    size_t released_bytes;           /**< Returned to the OS by the release policy, summed over all cycles. */
+    enum GC_COPY_ORDER copy_order;
+    size_t prefetch_distance;
+    void *stack_base;                /**< Top of the native stack scanned for ambiguous roots (STELLA_GC_CONSERVATIVE). */
+    void **ambiguous_roots;          /**< Words of the native stack found by the current cycle. */
+    size_t ambiguous_size, ambiguous_capacity;
+    gc_pinned_run *pinned_runs;      /**< Pinned by earlier cycles, sorted by address. */
+    size_t pinned_runs_size, pinned_runs_capacity;
+    size_t pinned_bytes;             /**< Bytes of the objects in pinned_runs. */
+    gc_pinned_run *new_pinned_runs;  /**< Pinned by the current cycle. */
+    size_t new_pinned_size, new_pinned_capacity;
+    size_t page_shift;               /**< Log2 of the size of the pages pinned in place. */
+    void **from_space_starts;        /**< For every page of from-space, the object holding its first byte. */
+    void **to_space_starts;          /**< The same for to-space, filled as objects are copied. */
+    void *reservation;               /**< Address space of every heap space (STELLA_COMPRESSED_REFS). */
+    size_t reservation_size;
+    gc_free_range *free_ranges;      /**< Unused parts of the reservation, sorted by address. */
+    size_t free_ranges_size, free_ranges_capacity;
+    uint64_t cycle_start_ns;         /**< Start of the current major cycle, for its trace event (STELLA_GC_TRACE). */
 } gc_state;
 
 typedef struct Gc_stats {
@@ -56,27 +510,185 @@ typedef struct Gc_stats {
     size_t read_barriers;
     size_t write_barriers;
     size_t gc_cycles;
+    size_t minor_gc_cycles;
+    size_t major_gc_cycles;
+    size_t promoted_bytes;
+    size_t promoted;
+    size_t heap_size;
+    size_t peak_heap_size;
+    size_t heap_grows;
+    size_t heap_shrinks;
+    size_t incremental_steps;
+    size_t incremental_scanned_bytes;
+    size_t large_objects_allocated;
+    size_t large_objects_freed;
+    size_t ambiguous_roots;          /**< Native stack words which pointed into the heap, summed over all cycles. */
+    size_t pinned_bytes;             /**< Bytes of the objects pinned in place, summed over all cycles. */
+    uint64_t start_ns;
+    uint64_t gc_ns;
+    uint64_t root_forwarding_ns;
+    uint64_t scan_ns;
+    gc_histogram pauses[GC_PAUSE_KINDS];
+    size_t parallel_cycles;
+    size_t gc_workers;
+    gc_worker_stats workers[GC_MAX_WORKERS];
 } gc_stats;
 
-extern gc_state current_state;
-extern gc_stats stats;
+#ifdef STELLA_GC_PROFILE
+/** Heap demographics (STELLA_GC_PROFILE). Allocations are counted by tag and size class.
+ * Every cycle takes a census of the objects that survived it (copied, promoted or marked),
+ * by tag and by age, which ends up as one sample of the time series.
+ */
+typedef struct Gc_profile {
+    size_t allocated[GC_PROFILE_TAGS][GC_PROFILE_SIZE_CLASSES];        /**< Objects, summed over the run. */
+    size_t allocated_bytes[GC_PROFILE_TAGS][GC_PROFILE_SIZE_CLASSES];
+    size_t sampled_bytes[GC_PROFILE_TAGS];    /**< Bytes of each tag allocated up to the last sample. */
+    size_t live_bytes[GC_PROFILE_TAGS];       /**< Census of the current cycle. */
+    size_t live_bytes_by_age[GC_MAX_AGE + 1];
+    size_t samples;
+    uint64_t start_ns;
+    FILE *out;                                /**< The time series, NULL if it is not written. */
+} gc_profile;
+#endif
+
+/** A heap with its spaces, roots and statistics. */
+typedef struct Gc_context {
+    gc_state state;
+    gc_stats statistics;
+#ifdef STELLA_GC_PROFILE
+    gc_profile profile;
+#endif
+    int allocated_fields;            /**< Fields of the allocated Stella objects (STELLA_RUNTIME_STATS). */
+} gc_context;
+
+/** The heap of a process without STELLA_GC_CONTEXTS, and of every thread which did not bind another one. */
+extern gc_context gc_default_context;
+
+/** With STELLA_GC_CONTEXTS every thread works on the heap it has bound (see gc_context_bind),
+ * GC_CONTEXT then refers to that heap.
+ */
+#ifdef STELLA_GC_CONTEXTS
+extern __thread gc_context *gc_bound_context;
+#define GC_CONTEXT gc_bound_context
+#else
+#define GC_CONTEXT (&gc_default_context)
+#endif
+
+#ifdef STELLA_GC_CONTEXTS
+/** Create an empty heap, configured from the environment on its first allocation (see gc_alloc).
+ * Returns NULL if there is no memory for it.
+ * Its statistics and heap profile are not written at exit, unlike those of the default heap:
+ * a thread reports on it with print_gc_stats_json and the other print functions while bound to it.
+ * Its events do go to the trace (STELLA_GC_TRACE), which is shared by all heaps.
+ */
+gc_context *gc_context_create();
+
+/** Free a heap and everything allocated in it. No thread may use it afterwards;
+ * the calling thread goes back to the default heap if it was bound to this one.
+ * The default heap cannot be destroyed.
+ */
+void gc_context_destroy(gc_context *context);
+
+/** Make the calling thread allocate in, collect and report on the given heap
+ * (the default heap if context is NULL). Returns the previously bound heap.
+ * A heap must only be used by one thread at a time.
+ */
+gc_context *gc_context_bind(gc_context *context);
+#endif
 
 /** Allocate an object on the heap of AT LEAST size_in_bytes bytes.
  * If necessary, this should start/continue garbage collection.
  * Returns a pointer to the newly allocated object.
+ *
+ * The first call reads the heap configuration from the environment:
+ * STELLA_GC_INITIAL_HEAP and STELLA_GC_MAX_HEAP (bytes, optionally suffixed with k, m or g)
+ * and STELLA_GC_OCCUPANCY (target occupancy factor, see HEAP_OCCUPANCY_FACTOR).
+ * The incremental collector is paced by STELLA_GC_WORK_RATIO and STELLA_GC_STEP_BUDGET_US
+ * (see GC_WORK_RATIO and GC_STEP_BUDGET_US).
+ * STELLA_GC_RELEASE and STELLA_GC_HUGE_PAGES choose how the spaces are mapped and released
+ * (see GC_DEFAULT_RELEASE and GC_DEFAULT_PAGES), STELLA_GC_COPY_ORDER and STELLA_GC_PREFETCH
+ * the evacuation order (see GC_DEFAULT_COPY_ORDER and GC_PREFETCH_DISTANCE).
+ * With STELLA_GC_PARALLEL, STELLA_GC_THREADS sets the number of evacuation threads (see GC_MAX_WORKERS).
+ * If STELLA_GC_STATS_JSON names a file, print_gc_stats_json writes to it at exit.
+ * With STELLA_GC_PROFILE, the heap profile goes to STELLA_GC_PROFILE_FILE (see GC_PROFILE_FILE;
+ * empty for none): a tab-separated time series with a sample per cycle, whose alloc.TAG columns hold
+ * the bytes allocated since the previous sample, live.TAG the bytes that survived the cycle
+ * and age.N the surviving bytes which are N cycles old.
+ * Both of them describe the default heap only (see gc_context_create).
+ * With STELLA_GC_TRACE, the last STELLA_GC_TRACE_EVENTS events of all heaps (see GC_TRACE_EVENTS)
+ * go to STELLA_GC_TRACE_FILE at exit (see GC_TRACE_FILE; empty for none), see print_gc_trace_json.
  */
 void *gc_alloc(size_t size_in_bytes);
 
+/** Heap bytes taken by an object with fields_count fields. */
+#define GC_OBJECT_SIZE(fields_count) MAX(sizeof(stella_object) + (size_t) (fields_count) * sizeof(stella_field), GC_MIN_OBJ_SIZE)
+
+/** Largest run reserved by gc_alloc_bulk: below LARGE_OBJECT_SIZE and within the nursery,
+ * so that the run comes from the space its objects would have been allocated in one by one.
+ */
+#define GC_BULK_MAX_SIZE MIN(LARGE_OBJECT_SIZE - 1, NURSERY_SIZE)
+
+/** A run of heap space reserved by gc_alloc_bulk. Objects are taken from it at next
+ * (see alloc_stella_object_bulk) until next reaches end.
+ */
+typedef struct Gc_bulk {
+    char *next;
+    char *end;
+} gc_bulk;
+
+/** Reserve size_in_bytes contiguous bytes (at most GC_BULK_MAX_SIZE) for count objects
+ * with a single limit check and at most one collection step, instead of count calls to gc_alloc.
+ * The caller must take and initialize all of them (GC_OBJECT_SIZE bytes each) before it allocates
+ * anything else: the collector does not run in between, so it never sees a partially built structure,
+ * and it expects the run to be filled with objects afterwards.
+ * A run which is too large, or too small for count objects, is not reserved: the result is empty
+ * (next is NULL) and the caller splits the run or allocates the objects one by one.
+ */
+gc_bulk gc_alloc_bulk(size_t count, size_t size_in_bytes);
+
+#ifdef STELLA_GC_PROFILE
+/** Count a new object in the heap profile, once alloc_stella_object has set its header. */
+void gc_profile_allocation(void *object);
+#endif
+
 /** GC-specific code which must be executed on each READ operation.
+ * This is the slow path: it forwards the field if a cycle is in progress.
  */
 void gc_read_barrier(void *object, int field_index);
 
 /** GC-specific code which must be executed on each WRITE operation
  * (except object field initialization).
+ * In the generational mode this records old-to-young pointers in the remembered set.
  */
 void gc_write_barrier(void *object, int field_index, void *contents);
 
+/** Inline fast path of the read barrier: a single branch on the GC phase.
+ * With FULL statistics it counts every barrier executed, not only the slow path.
+ */
+static inline void gc_read_barrier_fast(void *object, int field_index) {
+    GC_STATS_FULL(GC_CONTEXT->statistics.read_barriers++;)
+    if (GC_UNLIKELY(GC_CONTEXT->state.gc_running)) {
+        gc_read_barrier(object, field_index);
+    }
+}
+
+/** Inline fast path of the write barrier: only stores of a nursery pointer
+ * into an object outside of the nursery take the slow path.
+ * With FULL statistics it counts every barrier executed, not only the slow path.
+ */
+static inline void gc_write_barrier_fast(void *object, int field_index, void *contents) {
+    GC_STATS_FULL(GC_CONTEXT->statistics.write_barriers++;)
+    gc_state *state = &GC_CONTEXT->state;
+    uintptr_t nursery = (uintptr_t) state->nursery;
+    if (GC_UNLIKELY((uintptr_t) contents - nursery < state->nursery_size
+                    && (uintptr_t) object - nursery >= state->nursery_size)) {
+        gc_write_barrier(object, field_index, contents);
+    }
+}
+
 /** Push a reference to a root (variable) on the GC's stack of roots.
+ * With STELLA_GC_CONSERVATIVE the variables on the native stack need not be pushed (they are found
+ * there, as ambiguous roots), only the roots held elsewhere, e.g. in global or malloc'ed memory.
  */
 void gc_push_root(void **object);
 
@@ -85,6 +697,66 @@ void gc_push_root(void **object);
  */
 void gc_pop_root(void **object);
 
+/** Push count references to roots at once (a frame of the shadow stack).
+ * Returns the frame to be passed to gc_pop_frame.
+ */
+size_t gc_push_roots(size_t count, void **objects[]);
+
+/** Pop every root pushed since the given frame was returned by gc_push_roots.
+ */
+void gc_pop_frame(size_t frame);
+
+/** Save the objects reachable from objects[0..count) to a heap image at path,
+ * or those reachable from the current roots if objects is NULL.
+ * A cycle in progress is completed first. The objects must be immutable: the image cannot hold
+ * reference cells. Pointers to static objects and code are saved relative to the executable,
+ * so only the same executable can load the image. Returns false (and reports why on stderr) on failure.
+ * Images hold 64-bit fields: they are not available with STELLA_COMPRESSED_REFS.
+ */
+bool gc_save_snapshot(const char *path, void **objects, size_t count);
+
+/** Map a heap image saved by gc_save_snapshot read-only and relocate it.
+ * Its objects are immortal: the collector never moves, frees or scans them
+ * (they only point to each other and to static objects).
+ * Returns the saved objects (the roots' values when they were saved from the roots)
+ * and stores their number in count, or returns NULL (reporting why on stderr).
+ */
+void **gc_load_snapshot(const char *path, size_t *count);
+
+/** Make the calling thread a mutator of the shared heap (STELLA_GC_MULTI_MUTATOR):
+ * it gets its own allocation buffer and stack of roots. The first allocation or root push
+ * of a thread registers it implicitly. Without STELLA_GC_MULTI_MUTATOR this does nothing.
+ */
+void gc_register_thread();
+
+/** Leave the shared heap; done implicitly when a registered thread exits.
+ * The thread must not hold heap references afterwards.
+ */
+void gc_unregister_thread();
+
+/** Bracket code that blocks or runs long without allocating (such as joining other mutators),
+ * so that collections requested meanwhile do not wait for the thread.
+ * The thread must not touch the heap in between, its rooted variables are updated by the collector.
+ */
+void gc_blocking_begin();
+void gc_blocking_end();
+
+#ifdef STELLA_GC_MULTI_MUTATOR
+void gc_safepoint_slow();
+#endif
+
+/** Stop here if another thread waits to collect. Allocation is a safepoint already,
+ * loops that do not allocate should call this. The current values of all roots must be
+ * stored in their variables.
+ */
+static inline void gc_safepoint() {
+#ifdef STELLA_GC_MULTI_MUTATOR
+    if (GC_UNLIKELY(__atomic_load_n(&GC_CONTEXT->state.stop_requested, __ATOMIC_RELAXED))) {
+        gc_safepoint_slow();
+    }
+#endif
+}
+
 /** Print GC statistics. Output must include at least:
  *
  * 1. Total allocated memory (bytes and objects).
@@ -95,12 +767,39 @@ void gc_pop_root(void **object);
  */
 void print_gc_alloc_stats();
 
+/** Print GC statistics (including pause histograms and phase timings) as a single JSON object.
+ */
+void print_gc_stats_json(FILE *out);
+
+#ifdef STELLA_GC_TRACE
+/** Print the events of the trace ring buffer in the Chrome trace-event format (a JSON object
+ * for chrome://tracing or ui.perfetto.dev): cycles, steps and root forwarding as complete events
+ * of the thread that ran them, flips, resizes and out of memory as instant events, and the heap size
+ * as a counter. Timestamps are CLOCK_MONOTONIC microseconds, so that they line up with other traces
+ * of the process. Events recorded meanwhile by other threads may be torn.
+ */
+void print_gc_trace_json(FILE *out);
+#endif
+
+/** Bring the statistics up to date: with cheap statistics allocation is only accounted at collections.
+ * The print functions do this themselves, call it before reading gc_current_stats directly.
+ */
+void gc_update_stats();
+
+/** The statistics of the current heap (the bound one with STELLA_GC_CONTEXTS). */
+gc_stats *gc_current_stats();
+
+/** The collector state of the current heap, e.g. to check whether a cycle is running. */
+gc_state *gc_current_state();
+
 /** Print GC state. Output must include at least:
  *
  * 1. Heap state.
  * 2. Set of roots (or heap pointers immediately available from roots).
  * 3. Current allocated memory (bytes and objects).
  * 4. GC variable values (e.g. scan/next/limit variables in a copying collector).
+ *
+ * It also reports the resident set: of the process and of each heap space.
  */
 void print_gc_state();
 
@@ -2,38 +2,131 @@
 #define STELLA_RUNTIME_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "gc.h"
 
+#ifdef STELLA_COMPRESSED_REFS
+#if UINTPTR_MAX <= 0xFFFFFFFFu
+#error "STELLA_COMPRESSED_REFS needs 64-bit pointers"
+#endif
+/** With STELLA_COMPRESSED_REFS, a field holds what it points to as a 32-bit offset from STELLA_HEAP_BASE,
+ * which lies STELLA_HEAP_BASE_OFFSET bytes below the_ZERO: the code and the static objects of the
+ * executable are above it, and so are the heap spaces, which the GC reserves in the rest of the 4 GiB
+ * (so the runtime must be linked statically into the executable).
+ * The header and the fields are 32 bits each, so a succ(_) object takes 8 bytes instead of 16.
+ * A field cannot hold NULL, and a static object cannot be initialized with a pointer:
+ * its fields are set at run time with STELLA_OBJECT_INIT_FIELD.
+ */
+typedef uint32_t stella_field;
+#define STELLA_HEAP_BASE_OFFSET ((uintptr_t) 1 << 30)
+#define STELLA_HEAP_BASE ((uintptr_t) &the_ZERO - STELLA_HEAP_BASE_OFFSET)
+/** The pointer a field holds. */
+#define STELLA_FIELD_DECODE(field) ((void*)(STELLA_HEAP_BASE + (uintptr_t)(field)))
+/** The field holding a pointer. */
+#define STELLA_FIELD_ENCODE(p) ((stella_field)((uintptr_t)(p) - STELLA_HEAP_BASE))
+#else
+typedef void* stella_field;
+#define STELLA_FIELD_DECODE(field) ((void*)(field))
+#define STELLA_FIELD_ENCODE(p) ((void*)(p))
+#endif
+
 /** A Stella object with statically unknown number of fields.
  */
 typedef struct {
   int    object_header;     /**< Header of the object contains
                               * its TAG (see STELLA_OBJECT_HEADER_TAG) and
                               * the number of fields (see STELLA_OBJECT_HEADER_FIELD_COUNT). */
-  void*  object_fields[0];  /**< An array of object fields (0 fields for static objects). */
+  stella_field object_fields[0];  /**< An array of object fields (0 fields for static objects). */
 } stella_object;
 
+/** A field of a Stella object as a pointer, without a barrier (for the GC and freshly allocated objects). */
+#define STELLA_OBJECT_FIELD(obj, i) STELLA_FIELD_DECODE(((stella_object*)(obj))->object_fields[i])
+/** Store a pointer into a field of a Stella object, without a barrier. */
+#define STELLA_OBJECT_SET_FIELD(obj, i, x) (((stella_object*)(obj))->object_fields[i] = STELLA_FIELD_ENCODE(x))
+
 /** Read a field from a Stella object. Subject to a read barrier. */
-#define STELLA_OBJECT_READ_FIELD(obj, i) GC_READ_BARRIER(obj, i, ((stella_object*)(obj->object_fields[i])))
+#define STELLA_OBJECT_READ_FIELD(obj, i) GC_READ_BARRIER(obj, i, ((stella_object*)STELLA_OBJECT_FIELD(obj, i)))
 /** (Over)write a field from a Stella object. Subject to a write barrier.
  * See STELLA_OBJECT_INIT_FIELD for initialization of fields (which does not trigger the write barrier).
  */
-#define STELLA_OBJECT_WRITE_FIELD(obj, i, x) GC_WRITE_BARRIER(obj, i, x, (obj->object_fields[i] = (void*)x))
+#define STELLA_OBJECT_WRITE_FIELD(obj, i, x) GC_WRITE_BARRIER(obj, i, x, STELLA_OBJECT_SET_FIELD(obj, i, x))
+
+#ifdef STELLA_IMMEDIATE_NATS
+#if UINTPTR_MAX <= 0xFFFFFFFFu
+#error "STELLA_IMMEDIATE_NATS needs 64-bit pointers"
+#endif
+#ifdef STELLA_COMPRESSED_REFS
+#error "STELLA_IMMEDIATE_NATS cannot be combined with STELLA_COMPRESSED_REFS (immediates do not fit into 32-bit fields)"
+#endif
+/** With STELLA_IMMEDIATE_NATS, a Nat n >= 1 is an immediate: a pointer with the top bit set
+ * and n in the bits above the alignment bits. User-space addresses never have the top bit set,
+ * so immediates are never allocated, never dereferenced and never copied by the GC
+ * (they are outside of every heap space). Zero is still the_ZERO, and heap-allocated
+ * SUCC objects remain valid (their argument may be an immediate).
+ */
+#define STELLA_IMMEDIATE_BIT ((uintptr_t) 1 << (8 * sizeof(uintptr_t) - 1))
+#define STELLA_IMMEDIATE_SHIFT 3
+/** Whether a Stella object is an immediate Nat. */
+#define STELLA_IS_IMMEDIATE(obj) (((uintptr_t) (obj) & STELLA_IMMEDIATE_BIT) != 0)
+/** The immediate representing n (n >= 1). */
+#define STELLA_IMMEDIATE_NAT(n) ((stella_object *) (STELLA_IMMEDIATE_BIT | ((uintptr_t) (n) << STELLA_IMMEDIATE_SHIFT)))
+/** The n represented by an immediate. */
+#define STELLA_IMMEDIATE_NAT_VALUE(obj) (((uintptr_t) (obj) & ~STELLA_IMMEDIATE_BIT) >> STELLA_IMMEDIATE_SHIFT)
+#else
+#define STELLA_IS_IMMEDIATE(obj) 0
+#endif
+
+/** Header layout: bits 0-3 hold the TAG, bits 4-7 the fields count and bits 8-11 are reserved for the GC.
+ * Objects with STELLA_WIDE_FIELDS or more fields use the extended header: bits 4-7 hold STELLA_WIDE_FIELDS
+ * and the actual count is stored from bit STELLA_WIDE_FIELDS_SHIFT up (at most STELLA_MAX_FIELDS fields).
+ * With STELLA_GC_PROFILE the top bits hold the age of the object instead (see GC_HEADER_AGE_SHIFT).
+ */
+#define STELLA_WIDE_FIELDS 15
+#define STELLA_WIDE_FIELDS_SHIFT 12
+#ifdef STELLA_GC_PROFILE
+#define STELLA_MAX_FIELDS ((1 << (GC_HEADER_AGE_SHIFT - STELLA_WIDE_FIELDS_SHIFT)) - 1)
+#else
+#define STELLA_MAX_FIELDS ((1 << (31 - STELLA_WIDE_FIELDS_SHIFT)) - 1)
+#endif
+
+/** Fields count stored in a header, short or extended. */
+#define STELLA_HEADER_STORED_FIELD_COUNT(header) \
+  ((((header) & FIELD_COUNT_MASK) >> 4) == STELLA_WIDE_FIELDS \
+    ? ((header) >> STELLA_WIDE_FIELDS_SHIFT) & STELLA_MAX_FIELDS \
+    : ((header) & FIELD_COUNT_MASK) >> 4)
 
+#ifdef STELLA_IMMEDIATE_NATS
+/** Extract the TAG from Stella object's header.
+ * The header must be an lvalue (obj->object_header): the header is the first member,
+ * so its address tells whether obj is an immediate, whose header is never read.
+ */
+#define STELLA_OBJECT_HEADER_TAG(header) (STELLA_IS_IMMEDIATE(&(header)) ? TAG_SUCC : ((header) & TAG_MASK))
+/** Extract the fields count from Stella object's header (an immediate counts as succ(_) with one field). */
+#define STELLA_OBJECT_HEADER_FIELD_COUNT(header) (STELLA_IS_IMMEDIATE(&(header)) ? 1 : STELLA_HEADER_STORED_FIELD_COUNT(header))
+
+/** Extract the n from succ(n). The predecessor of an immediate is computed, not read. */
+#define STELLA_OBJECT_SUCC_ARG(obj) \
+  (STELLA_IS_IMMEDIATE(obj) \
+    ? (void *) (STELLA_IMMEDIATE_NAT_VALUE(obj) > 1 ? (stella_object *) ((uintptr_t) (obj) - ((uintptr_t) 1 << STELLA_IMMEDIATE_SHIFT)) : &the_ZERO) \
+    : STELLA_OBJECT_READ_FIELD(obj,0))
+#else
 /** Extract the TAG from Stella object's header. */
 #define STELLA_OBJECT_HEADER_TAG(header) (header & TAG_MASK)
 /** Extract the fields count from Stella object's header. */
-#define STELLA_OBJECT_HEADER_FIELD_COUNT(header) ((header & FIELD_COUNT_MASK) >> 4)
+#define STELLA_OBJECT_HEADER_FIELD_COUNT(header) STELLA_HEADER_STORED_FIELD_COUNT(header)
 
 /** Extract the n from succ(n). */
 #define STELLA_OBJECT_SUCC_ARG(obj) STELLA_OBJECT_READ_FIELD(obj,0)
+#endif
 
 /** Initialize new Stella object's TAG. */
 #define STELLA_OBJECT_INIT_TAG(obj, tag) (obj->object_header = ((obj->object_header & ~((1 << 4) - 1)) | tag))
-/** Initialize new Stella object's fields count. */
-#define STELLA_OBJECT_INIT_FIELDS_COUNT(obj, count) (obj->object_header = ((obj->object_header & ~(((1 << 4) - 1) << 4)) | count << 4))
+/** Initialize new Stella object's fields count (switching to the extended header for wide objects). */
+#define STELLA_OBJECT_INIT_FIELDS_COUNT(obj, count) \
+  (obj->object_header = ((obj->object_header & ~((((1 << 4) - 1) << 4) | (STELLA_MAX_FIELDS << STELLA_WIDE_FIELDS_SHIFT))) \
+    | ((count) < STELLA_WIDE_FIELDS ? (count) << 4 : (STELLA_WIDE_FIELDS << 4) | ((count) << STELLA_WIDE_FIELDS_SHIFT))))
 /** Initialize new Stella object's field. */
-#define STELLA_OBJECT_INIT_FIELD(obj, i, x) (obj->object_fields[i] = (void*)x)
+#define STELLA_OBJECT_INIT_FIELD(obj, i, x) STELLA_OBJECT_SET_FIELD(obj, i, x)
 
 /** Call a Stella function (closure) with a given Stella object as an argument. */
 #define STELLA_OBJECT_CLOSURE_CALL(f, x) (*(stella_object *(*)(stella_object *, stella_object *))STELLA_OBJECT_READ_FIELD(f, 0))(f, x)
@@ -42,10 +135,12 @@ typedef struct {
  * which is how closures for top-level definitions are represented by default.
  * This is only supposed to be used for static Stella objects, corresponding
  * to the top-level function definitions (the only field being the address of the function).
+ * With STELLA_COMPRESSED_REFS the field cannot be initialized with that address,
+ * so compiled Stella programs do not build in that mode (see the top-level CMakeLists.txt).
  */
 typedef struct {
   int    object_header;     /**< Header of the object. Same as in stella_object. */
-  void*  object_fields[1];  /**< An array of object fields (1 field for static objects). */
+  stella_field object_fields[1];  /**< An array of object fields (1 field for static objects). */
 } stella_object_1;
 
 /** An enumeration of possible Stella object tags. */
@@ -64,12 +159,29 @@ enum TAG {
   TAG_CONS    /**< cons(..., ...) */
   } ;
 
-/** Allocate a new Stella object with a given TAG and number of fields.
+/** Allocate a new Stella object with a given TAG and number of fields (at most STELLA_MAX_FIELDS).
  * Note that this function makes use of gc_alloc.
  */
 stella_object* alloc_stella_object(enum TAG tag, int fields_count);
 
-/** Convert a natural number (non-negative integer) into a corresponding Stella object. */
+struct Gc_bulk;
+
+/** Take a new Stella object with a given TAG and number of fields (at least one) from a run
+ * reserved with gc_alloc_bulk, in which it takes GC_OBJECT_SIZE(fields_count) bytes.
+ * Like every object of the run, it must be initialized before anything else is allocated.
+ * NULL (and a failed assertion in debug builds) if the run is empty or has no room left for it.
+ */
+stella_object* alloc_stella_object_bulk(struct Gc_bulk *bulk, enum TAG tag, int fields_count);
+
+/** Build succ(n). Unlike alloc_stella_object(TAG_SUCC, 1), which does not know the argument
+ * (its object is only replaced by a shared one when the collector evacuates it, see stella_shared_succ),
+ * this returns a shared object (see the_SMALL_NATS) or an immediate when it can, and allocates otherwise.
+ */
+stella_object *stella_object_succ(stella_object *n);
+
+/** Convert a natural number (non-negative integer) into a corresponding Stella object.
+ * With STELLA_IMMEDIATE_NATS this allocates nothing and returns an immediate.
+ */
 stella_object *nat_to_stella_object(int n);
 /** Convert a natural number represented as a Stella object to an integer. */
 int stella_object_to_nat(stella_object* obj);
@@ -99,6 +211,34 @@ extern stella_object the_FALSE;
 /** The static Stella object for true. */
 extern stella_object the_TRUE;
 
+/** Number of shared succ objects (0 disables them). */
+#ifndef STELLA_SMALL_NATS
+#define STELLA_SMALL_NATS 256
+#endif
+
+#if STELLA_SMALL_NATS > 32768
+#error "STELLA_SMALL_NATS is at most 32768"
+#endif
+
+#if STELLA_SMALL_NATS > 0
+/** Shared succ objects for 1..STELLA_SMALL_NATS: the_SMALL_NATS[n - 1] represents n
+ * and its argument is the_SMALL_NATS[n - 2] (the_ZERO for n = 1).
+ * They live outside of the heap, so the GC never copies or scans them. The table is read-only,
+ * except with STELLA_COMPRESSED_REFS, where the cells are linked before main.
+ */
+#ifdef STELLA_COMPRESSED_REFS
+extern stella_object_1 the_SMALL_NATS[STELLA_SMALL_NATS];
+#else
+extern const stella_object_1 the_SMALL_NATS[STELLA_SMALL_NATS];
+#endif
+
+/** The shared object for succ(n), or NULL if n is neither the_ZERO nor a shared object below the last one.
+ * The copying collectors use it to evacuate a heap SUCC object of such an n to the shared object,
+ * which is how the cells that generated code fills after alloc_stella_object(TAG_SUCC, 1) get shared.
+ */
+stella_object *stella_shared_succ(stella_object *n);
+#endif
+
 /** The bitmask for the fields count. */
 extern const int FIELD_COUNT_MASK;
 
@@ -2,38 +2,440 @@
 // Created by Nikita Morozov on 25.10.2025.
 //
 
+#define _POSIX_C_SOURCE 200112L
+// MAP_ANONYMOUS, madvise and mincore
+#define _DEFAULT_SOURCE
+#ifdef STELLA_GC_CONSERVATIVE
+// pthread_getattr_np
+#define _GNU_SOURCE
+#endif
+
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#if defined(STELLA_GC_PARALLEL) || defined(STELLA_GC_MULTI_MUTATOR) || defined(STELLA_GC_CONSERVATIVE)
+#include <pthread.h>
+#endif
+#ifdef STELLA_GC_CONSERVATIVE
+#include <setjmp.h>
+#endif
+#ifdef STELLA_GC_PARALLEL
+#include <sched.h>
+#endif
+#if defined(STELLA_GC_TRACE) && defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#ifdef STELLA_GC_USDT
+#include <sys/sdt.h>
+#endif
 
 #include "stella/gc.h"
 
+#define current_state (GC_CONTEXT->state)
+#define stats (GC_CONTEXT->statistics)
+
+
+/** The state of a heap which has not allocated anything yet:
+ * gc_default_context and every context made by gc_context_create start from it.
+ */
+#define GC_CONTEXT_TEMPLATE {                               \
+        .state = {                                          \
+                .from_space = NULL,                         \
+                .to_space = NULL,                           \
+                .from_space_size = 0,                       \
+                .to_space_size = 0,                         \
+                .scan = NULL,                               \
+                .next = NULL,                               \
+                .limit = NULL,                              \
+                .roots = NULL,                              \
+                .roots_size = 0,                            \
+                .roots_capacity = 0,                        \
+                .gc_running = false,                        \
+                .stop_requested = false,                    \
+                .parallel_cycle = false,                    \
+                .nursery = NULL,                            \
+                .nursery_size = 0,                          \
+                .nursery_next = NULL,                       \
+                .nursery_limit = NULL,                      \
+                .remembered_set = NULL,                     \
+                .remembered_size = 0,                       \
+                .remembered_capacity = 0,                   \
+                .tenured_start = NULL,                      \
+                .tenured_large = NULL,                      \
+                .tenured_large_size = 0,                    \
+                .tenured_large_capacity = 0,                \
+                .heap_initial_size = 0,                     \
+                .heap_max_size = 0,                         \
+                .heap_occupancy = HEAP_OCCUPANCY_FACTOR,    \
+                .heap_target_size = 0,                      \
+                .evacuation_reserve = 0,                    \
+                .headroom = 0,                              \
+                .hidden_bytes = 0,                          \
+                .live_at_flip = 0,                          \
+                .work_ratio = GC_WORK_RATIO,                \
+                .step_budget_us = GC_STEP_BUDGET_US,        \
+                .pause_depth = 0,                           \
+                .pause_kind = GC_PAUSE_STEP,                \
+                .pause_start_ns = 0,                        \
+                .alloc_mark = NULL,                         \
+                .allocated_at_flip = 0,                     \
+                .large_objects = NULL,                      \
+                .large_objects_size = 0,                    \
+                .large_objects_capacity = 0,                \
+                .large_objects_bytes = 0,                   \
+                .large_allocated_since_flip = 0,            \
+                .gray_objects = NULL,                       \
+                .gray_size = 0,                             \
+                .gray_capacity = 0,                         \
+                .snapshots = NULL,                          \
+                .snapshots_size = 0,                        \
+                .snapshots_capacity = 0,                    \
+                .release_policy = GC_DEFAULT_RELEASE,       \
+                .page_kind = GC_DEFAULT_PAGES,              \
+                .released_bytes = 0,                        \
+                .copy_order = GC_DEFAULT_COPY_ORDER,        \
+                .prefetch_distance = GC_PREFETCH_DISTANCE,  \
+                .stack_base = NULL,                         \
+                .ambiguous_roots = NULL,                    \
+                .ambiguous_size = 0,                        \
+                .ambiguous_capacity = 0,                    \
+                .pinned_runs = NULL,                        \
+                .pinned_runs_size = 0,                      \
+                .pinned_runs_capacity = 0,                  \
+                .pinned_bytes = 0,                          \
+                .new_pinned_runs = NULL,                    \
+                .new_pinned_size = 0,                       \
+                .new_pinned_capacity = 0,                   \
+                .page_shift = 0,                            \
+                .from_space_starts = NULL,                  \
+                .to_space_starts = NULL,                    \
+                .reservation = NULL,                        \
+                .reservation_size = 0,                      \
+                .free_ranges = NULL,                        \
+                .free_ranges_size = 0,                      \
+                .free_ranges_capacity = 0,                  \
+                .cycle_start_ns = 0,                        \
+        },                                                  \
+        .statistics = {                                     \
+                .total_allocated_bytes= 0,                  \
+                .total_allocated= 0,                        \
+                .maximum_residency_bytes= 0,                \
+                .maximum_residency= 0,                      \
+                .residency_bytes= 0,                        \
+                .residency= 0,                              \
+                .reads= 0,                                  \
+                .writes= 0,                                 \
+                .read_barriers= 0,                          \
+                .write_barriers= 0,                         \
+                .gc_cycles= 0,                              \
+                .minor_gc_cycles= 0,                        \
+                .major_gc_cycles= 0,                        \
+                .promoted_bytes= 0,                         \
+                .promoted= 0,                               \
+                .heap_size= 0,                              \
+                .peak_heap_size= 0,                         \
+                .heap_grows= 0,                             \
+                .heap_shrinks= 0,                           \
+                .incremental_steps= 0,                      \
+                .incremental_scanned_bytes= 0,              \
+                .large_objects_allocated= 0,                \
+                .large_objects_freed= 0,                    \
+                .ambiguous_roots= 0,                        \
+                .pinned_bytes= 0,                           \
+                .start_ns= 0,                               \
+                .gc_ns= 0,                                  \
+                .root_forwarding_ns= 0,                     \
+                .scan_ns= 0,                                \
+                .pauses= {{{0}}},                           \
+                .parallel_cycles= 0,                        \
+                .gc_workers= 1,                             \
+                .workers= {{0}},                            \
+        },                                                  \
+        .allocated_fields = 0,                              \
+}
+
+gc_context gc_default_context = GC_CONTEXT_TEMPLATE;
+
+#ifdef STELLA_GC_CONTEXTS
+__thread gc_context *gc_bound_context = &gc_default_context;
+#endif
+
+static const char *stats_json_path = NULL;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GC_PREFETCH(p) __builtin_prefetch(p)
+#define GC_NOINLINE __attribute__((noinline))
+#define GC_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define GC_PREFETCH(p) ((void) (p))
+#define GC_NOINLINE
+#define GC_NO_SANITIZE_ADDRESS
+#endif
+
+/** Tell the CPU that the thread busy-waits (less power, and no pipeline flush when the wait ends). */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define GC_SPIN_PAUSE() __builtin_ia32_pause()
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+#define GC_SPIN_PAUSE() __asm__ __volatile__("yield")
+#else
+#define GC_SPIN_PAUSE() ((void) 0)
+#endif
+
+/** Static probes of the stella_gc provider (STELLA_GC_USDT, see GC_TRACE_KIND). */
+#ifdef STELLA_GC_USDT
+#define GC_PROBE(name) DTRACE_PROBE(stella_gc, name)
+#define GC_PROBE1(name, a) DTRACE_PROBE1(stella_gc, name, a)
+#define GC_PROBE2(name, a, b) DTRACE_PROBE2(stella_gc, name, a, b)
+#else
+#define GC_PROBE(name) ((void) 0)
+#define GC_PROBE1(name, a) ((void) 0)
+#define GC_PROBE2(name, a, b) ((void) 0)
+#endif
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+static void histogram_add(gc_histogram *histogram, uint64_t ns) {
+    size_t bucket = 0;
+    while (bucket + 1 < GC_HISTOGRAM_BUCKETS && (ns >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->total_ns += ns;
+    histogram->max_ns = MAX(histogram->max_ns, ns);
+}
+#endif
+
+/** Upper bound of the bucket containing the p-th quantile (capped by the maximum).
+ */
+static uint64_t histogram_percentile(const gc_histogram *histogram, double p) {
+    size_t rank = (size_t) (p * (double) histogram->count);
+    size_t seen = 0;
+    for (size_t bucket = 0; bucket < GC_HISTOGRAM_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen > rank) {
+            return MIN((uint64_t) 2 << bucket, histogram->max_ns);
+        }
+    }
+    return histogram->max_ns;
+}
+
+/** Mark the start of a mutator pause. Pauses nest (a step may grow the heap),
+ * only the outermost one is recorded.
+ */
+static void pause_begin(enum GC_PAUSE_KIND kind) {
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    if (current_state.pause_depth++ == 0) {
+        current_state.pause_kind = kind;
+        current_state.pause_start_ns = now_ns();
+    }
+#else
+    (void) kind;
+#endif
+}
+
+static void pause_end() {
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    if (--current_state.pause_depth == 0) {
+        uint64_t ns = now_ns() - current_state.pause_start_ns;
+        stats.gc_ns += ns;
+        histogram_add(&stats.pauses[current_state.pause_kind], ns);
+    }
+#endif
+}
+
+#ifdef STELLA_GC_PROFILE
 
-gc_state current_state = {
-        .from_space = NULL,
-        .to_space = NULL,
-        .from_space_size = 0,
-        .to_space_size = 0,
-        .scan = NULL,
-        .next = NULL,
-        .limit = NULL,
-        .roots_list = NULL,
-        .roots_last = NULL,
-        .roots_size = 0,
-        .gc_running = false,
+static const char *profile_tag_names[] = {
+        "ZERO", "SUCC", "FALSE", "TRUE", "FN", "REF", "UNIT", "TUPLE", "INL", "INR", "EMPTY", "CONS",
 };
+#define PROFILE_TAGS (sizeof profile_tag_names / sizeof profile_tag_names[0])
+
+static const char *profile_size_class_names[GC_PROFILE_SIZE_CLASSES] = {
+        "1", "2", "3-4", "5-8", "9-16", "17-32", "33-64", "65+",
+};
+
+void gc_profile_allocation(void *object) {
+    stella_object *obj = (stella_object *) object;
+    size_t fields_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+    size_t size_class = 0;
+    while (size_class + 1 < GC_PROFILE_SIZE_CLASSES && (size_t) 1 << size_class < fields_count) {
+        size_class++;
+    }
+    size_t tag = STELLA_OBJECT_HEADER_TAG(obj->object_header);
+    GC_CONTEXT->profile.allocated[tag][size_class]++;
+    GC_CONTEXT->profile.allocated_bytes[tag][size_class] += GC_HEAP_OBJ_SIZE(obj);
+}
+
+/** Count an object that survives the current cycle, which makes it one cycle older.
+ * Called once per object and cycle: on its copy, or when it gets marked.
+ */
+static void census(stella_object *obj) {
+    int age = MIN(GC_HEADER_AGE(obj->object_header) + 1, GC_MAX_AGE);
+    obj->object_header = (obj->object_header & ~(GC_MAX_AGE << GC_HEADER_AGE_SHIFT)) | age << GC_HEADER_AGE_SHIFT;
+    size_t size = GC_HEAP_OBJ_SIZE(obj);
+    GC_CONTEXT->profile.live_bytes[STELLA_OBJECT_HEADER_TAG(obj->object_header)] += size;
+    GC_CONTEXT->profile.live_bytes_by_age[age] += size;
+}
+
+/** Write the census of the cycle that just ended (kind is "minor" or "major") and start a new one.
+ */
+static void profile_sample(const char *kind) {
+    gc_profile *profile = &GC_CONTEXT->profile;
+    profile->samples++;
+    size_t allocated[GC_PROFILE_TAGS] = {0};
+    for (size_t tag = 0; tag < GC_PROFILE_TAGS; tag++) {
+        for (size_t size_class = 0; size_class < GC_PROFILE_SIZE_CLASSES; size_class++) {
+            allocated[tag] += profile->allocated_bytes[tag][size_class];
+        }
+    }
+    if (profile->out) {
+        fprintf(profile->out, "%zu\t%.6f\t%s", profile->samples, (double) (now_ns() - profile->start_ns) / 1e9, kind);
+        for (size_t tag = 0; tag < PROFILE_TAGS; tag++) {
+            fprintf(profile->out, "\t%zu", allocated[tag] - profile->sampled_bytes[tag]);
+        }
+        for (size_t tag = 0; tag < PROFILE_TAGS; tag++) {
+            fprintf(profile->out, "\t%zu", profile->live_bytes[tag]);
+        }
+        for (size_t age = 1; age <= GC_MAX_AGE; age++) {
+            fprintf(profile->out, "\t%zu", profile->live_bytes_by_age[age]);
+        }
+        fputc('\n', profile->out);
+    }
+    memcpy(profile->sampled_bytes, allocated, sizeof allocated);
+    memset(profile->live_bytes, 0, sizeof profile->live_bytes);
+    memset(profile->live_bytes_by_age, 0, sizeof profile->live_bytes_by_age);
+}
+
+/** Append the allocation totals by tag and size class as comments and close the time series.
+ */
+static void profile_close() {
+    gc_profile *profile = &gc_default_context.profile;
+    fprintf(profile->out, "# allocated objects by tag and fields count:");
+    for (size_t size_class = 0; size_class < GC_PROFILE_SIZE_CLASSES; size_class++) {
+        fprintf(profile->out, "\t%s", profile_size_class_names[size_class]);
+    }
+    fputc('\n', profile->out);
+    for (size_t tag = 0; tag < PROFILE_TAGS; tag++) {
+        fprintf(profile->out, "# %s", profile_tag_names[tag]);
+        for (size_t size_class = 0; size_class < GC_PROFILE_SIZE_CLASSES; size_class++) {
+            fprintf(profile->out, "\t%zu", profile->allocated[tag][size_class]);
+        }
+        fputc('\n', profile->out);
+    }
+    fclose(profile->out);
+    profile->out = NULL;
+}
+
+/** Start the time series of the default heap at path, with a header line naming the columns.
+ */
+static void profile_open(const char *path) {
+    gc_profile *profile = &gc_default_context.profile;
+    profile->out = fopen(path, "w");
+    if (!profile->out) {
+        perror(path);
+        return;
+    }
+    fprintf(profile->out, "cycle\tseconds\tkind");
+    for (size_t tag = 0; tag < PROFILE_TAGS; tag++) {
+        fprintf(profile->out, "\talloc.%s", profile_tag_names[tag]);
+    }
+    for (size_t tag = 0; tag < PROFILE_TAGS; tag++) {
+        fprintf(profile->out, "\tlive.%s", profile_tag_names[tag]);
+    }
+    for (size_t age = 1; age <= GC_MAX_AGE; age++) {
+        fprintf(profile->out, "\tage.%zu", age);
+    }
+    fputc('\n', profile->out);
+    atexit(profile_close);
+}
 
-gc_stats stats = {
-        .total_allocated_bytes= 0,
-        .total_allocated= 0,
-        .maximum_residency_bytes= 0,
-        .maximum_residency= 0,
-        .residency_bytes= 0,
-        .residency= 0,
-        .reads= 0,
-        .writes= 0,
-        .read_barriers= 0,
-        .write_barriers= 0,
-        .gc_cycles= 0,
+#endif
+
+#ifdef STELLA_GC_TRACE
+
+static const struct {
+    const char *name;
+    char phase;             /**< 'X' for a complete event, 'i' for an instant one. */
+    const char *args[2];    /**< Names of the arguments, NULL for none. */
+} trace_kinds[GC_TRACE_KINDS] = {
+        [GC_TRACE_CYCLE] = {"cycle", 'X', {"live_bytes", "heap_bytes"}},
+        [GC_TRACE_MINOR] = {"minor", 'X', {"promoted_bytes", NULL}},
+        [GC_TRACE_ROOTS] = {"roots", 'X', {"roots", NULL}},
+        [GC_TRACE_STEP] = {"step", 'X', {"scanned_bytes", "allocated_bytes"}},
+        [GC_TRACE_FINISH] = {"finish", 'X', {"scanned_bytes", NULL}},
+        [GC_TRACE_FLIP] = {"flip", 'i', {"live_bytes", "target_heap_bytes"}},
+        [GC_TRACE_RESIZE] = {"heap_resize", 'i', {"old_heap_bytes", "new_heap_bytes"}},
+        [GC_TRACE_OOM] = {"out_of_memory", 'i', {"heap_bytes", "heap_max_bytes"}},
 };
 
+/** The ring buffer of the process, shared by all heaps and threads: a writer claims slot next % capacity
+ * by incrementing next. Allocated by the first gc_init.
+ */
+static struct {
+    gc_trace_event *events;
+    size_t capacity;
+    size_t next;
+} trace = {NULL, 0, 0};
+
+static const char *trace_path = NULL;
+
+static uint32_t trace_thread() {
+#ifdef __linux__
+    static __thread uint32_t thread = 0;
+    if (!thread) {
+        thread = (uint32_t) syscall(SYS_gettid);
+    }
+    return thread;
+#else
+    return 0;
+#endif
+}
+
+/** Timestamp of an event about to start. */
+static inline uint64_t trace_begin() {
+    return now_ns();
+}
+
+/** Record an event of the given kind which started at start_ns (now for an instant event). */
+static void trace_end(enum GC_TRACE_KIND kind, uint64_t start_ns, uint64_t arg0, uint64_t arg1) {
+    gc_trace_event *events = __atomic_load_n(&trace.events, __ATOMIC_ACQUIRE);
+    if (!events) {
+        return;
+    }
+    gc_trace_event *event = &events[__atomic_fetch_add(&trace.next, 1, __ATOMIC_RELAXED) % trace.capacity];
+    event->start_ns = start_ns;
+    event->duration_ns = trace_kinds[kind].phase == 'X' ? now_ns() - start_ns : 0;
+    event->args[0] = arg0;
+    event->args[1] = arg1;
+    event->kind = kind;
+    event->thread = trace_thread();
+}
+
+#else
+
+static inline uint64_t trace_begin() {
+    return 0;
+}
+
+static inline void trace_end(enum GC_TRACE_KIND kind, uint64_t start_ns, uint64_t arg0, uint64_t arg1) {
+    (void) kind;
+    (void) start_ns;
+    (void) arg0;
+    (void) arg1;
+}
+
+#endif
+
 
 bool is_from_space(void *p) {
     char *obj = (char *) p;
@@ -41,233 +443,2561 @@ bool is_from_space(void *p) {
     return from_space <= obj && obj < from_space + current_state.from_space_size;
 }
 
-bool is_to_space(void *p) {
-    char *obj = (char *) p;
-    char *to_space = (char *) current_state.to_space;
-    return to_space <= obj && obj < to_space + current_state.to_space_size;
-}
+bool is_to_space(void *p) {
+    char *obj = (char *) p;
+    char *to_space = (char *) current_state.to_space;
+    return to_space <= obj && obj < to_space + current_state.to_space_size;
+}
+
+bool is_nursery(void *p) {
+    char *obj = (char *) p;
+    char *nursery = (char *) current_state.nursery;
+    return nursery <= obj && obj < nursery + current_state.nursery_size;
+}
+
+static void out_of_memory() {
+    trace_end(GC_TRACE_OOM, trace_begin(), current_state.from_space_size, current_state.heap_max_size);
+    GC_PROBE2(out__of__memory, current_state.from_space_size, current_state.heap_max_size);
+    fprintf(stderr, "Out of memory (heap limit is %zu bytes)\n", current_state.heap_max_size);
+    print_gc_alloc_stats();
+    print_gc_roots();
+    print_gc_state();
+    exit(-1);
+}
+
+/** Granularity of the mappings of a heap space.
+ */
+static size_t space_unit(enum GC_PAGE_KIND page_kind) {
+    return page_kind == GC_PAGES_HUGETLB ? GC_HUGE_PAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+}
+
+static size_t space_mapped_size(size_t size, enum GC_PAGE_KIND page_kind) {
+    size_t unit = space_unit(page_kind);
+    return (size + unit - 1) / unit * unit;
+}
+
+#ifdef STELLA_COMPRESSED_REFS
+
+/* With compressed references every heap space (semispaces, nursery, large objects) is mapped over a part
+ * of a single reservation of address space, which covers the 4 GiB above STELLA_HEAP_BASE from
+ * GC_COMPRESSED_HEAP_GAP above the program break. Its unused parts are kept as free ranges, first fit.
+ */
+
+static void insert_free_range(size_t i, uintptr_t address, size_t size) {
+    if (current_state.free_ranges_size == current_state.free_ranges_capacity) {
+        size_t capacity = MAX(LARGE_OBJECTS_INITIAL_CAPACITY, 2 * current_state.free_ranges_capacity);
+        current_state.free_ranges = realloc(current_state.free_ranges, capacity * sizeof(gc_free_range));
+        current_state.free_ranges_capacity = capacity;
+    }
+    memmove(&current_state.free_ranges[i + 1], &current_state.free_ranges[i],
+            (current_state.free_ranges_size - i) * sizeof(gc_free_range));
+    current_state.free_ranges[i].address = (void *) address;
+    current_state.free_ranges[i].size = size;
+    current_state.free_ranges_size++;
+}
+
+/** Take size bytes aligned to align from the reservation, or NULL if they do not fit.
+ */
+static void *take_range(size_t size, size_t align) {
+    for (size_t i = 0; i < current_state.free_ranges_size; i++) {
+        gc_free_range *range = &current_state.free_ranges[i];
+        uintptr_t start = (uintptr_t) range->address, end = start + range->size;
+        uintptr_t taken = (start + align - 1) & ~(uintptr_t) (align - 1);
+        if (taken >= end || end - taken < size) {
+            continue;
+        }
+        if (taken > start) {
+            range->size = taken - start;
+            if (taken + size < end) {
+                insert_free_range(i + 1, taken + size, end - taken - size);
+            }
+        } else if (taken + size < end) {
+            range->address = (void *) (taken + size);
+            range->size = end - taken - size;
+        } else {
+            current_state.free_ranges_size--;
+            memmove(range, range + 1, (current_state.free_ranges_size - i) * sizeof(gc_free_range));
+        }
+        return (void *) taken;
+    }
+    return NULL;
+}
+
+/** Give [address, address + size) back to the reservation, without its pages.
+ */
+static void give_range(void *address, size_t size) {
+    mmap(address, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    uintptr_t start = (uintptr_t) address, end = start + size;
+    size_t i = 0;
+    while (i < current_state.free_ranges_size && (uintptr_t) current_state.free_ranges[i].address < start) {
+        i++;
+    }
+    gc_free_range *ranges = current_state.free_ranges;
+    bool after_previous = i > 0 && (uintptr_t) ranges[i - 1].address + ranges[i - 1].size == start;
+    bool before_next = i < current_state.free_ranges_size && (uintptr_t) ranges[i].address == end;
+    if (after_previous && before_next) {
+        ranges[i - 1].size += size + ranges[i].size;
+        current_state.free_ranges_size--;
+        memmove(&ranges[i], &ranges[i + 1], (current_state.free_ranges_size - i) * sizeof(gc_free_range));
+    } else if (after_previous) {
+        ranges[i - 1].size += size;
+    } else if (before_next) {
+        ranges[i].address = address;
+        ranges[i].size += size;
+    } else {
+        insert_free_range(i, start, size);
+    }
+}
+
+/** Reserve the address space of the heap. The code and the static objects must be in reach as well.
+ */
+static void reserve_heap() {
+    uintptr_t unit = GC_HUGE_PAGE_SIZE;
+    uintptr_t data_end = MAX((uintptr_t) &the_ZERO, (uintptr_t) sbrk(0));
+    uintptr_t start = (data_end + GC_COMPRESSED_HEAP_GAP + unit - 1) & ~(unit - 1);
+    uintptr_t end = (STELLA_HEAP_BASE + ((uintptr_t) 1 << 32)) & ~(unit - 1);
+    if ((uintptr_t) gc_alloc - STELLA_HEAP_BASE >= start - STELLA_HEAP_BASE
+        || start - STELLA_HEAP_BASE >= end - STELLA_HEAP_BASE) {
+        fprintf(stderr, "The code or the program break is out of reach of compressed references (STELLA_HEAP_BASE_OFFSET)\n");
+        exit(-1);
+    }
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#ifdef MAP_FIXED_NOREPLACE
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+    void *reservation = mmap((void *) start, end - start, PROT_NONE, flags, -1, 0);
+    if (reservation != (void *) start) {
+        // taken by another mapping (without MAP_FIXED_NOREPLACE the address is only a hint)
+        if (reservation != MAP_FAILED) {
+            munmap(reservation, end - start);
+        }
+        fprintf(stderr, "Cannot reserve the heap for compressed references at %p\n", (void *) start);
+        exit(-1);
+    }
+    current_state.reservation = reservation;
+    current_state.reservation_size = end - start;
+    insert_free_range(0, start, end - start);
+}
+
+/** Map size bytes of regular pages in the reservation (a large object), or NULL if they do not fit.
+ */
+static void *reservation_alloc(size_t size) {
+    size_t mapped = space_mapped_size(size, GC_PAGES_REGULAR);
+    void *address = take_range(mapped, space_unit(GC_PAGES_REGULAR));
+    if (address && mmap(address, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)
+                   == MAP_FAILED) {
+        give_range(address, mapped);
+        return NULL;
+    }
+    return address;
+}
+
+static void reservation_free(void *address, size_t size) {
+    give_range(address, space_mapped_size(size, GC_PAGES_REGULAR));
+}
+
+#endif
+
+/** Map a heap space (semispace or nursery) of size bytes with the pages of current_state.page_kind.
+ * Returns NULL if there is no memory for it.
+ */
+static void *space_alloc(size_t size) {
+    size_t mapped = space_mapped_size(size, current_state.page_kind);
+    void *address = NULL;
+    int fixed = 0;
+#ifdef STELLA_COMPRESSED_REFS
+    address = take_range(mapped, space_unit(current_state.page_kind));
+    if (!address) {
+        return NULL;
+    }
+    fixed = MAP_FIXED;
+#endif
+    void *space = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (current_state.page_kind == GC_PAGES_HUGETLB) {
+        space = mmap(address, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | fixed, -1, 0);
+    }
+#endif
+    if (space == MAP_FAILED) {
+        // no huge pages reserved (vm.nr_hugepages): regular pages, the size stays rounded for space_free
+        space = mmap(address, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | fixed, -1, 0);
+    }
+    if (space == MAP_FAILED) {
+#ifdef STELLA_COMPRESSED_REFS
+        give_range(address, mapped);
+#endif
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (current_state.page_kind == GC_PAGES_THP) {
+        madvise(space, mapped, MADV_HUGEPAGE);
+    }
+#endif
+    return space;
+}
+
+static void space_free(void *space, size_t size, enum GC_PAGE_KIND page_kind) {
+    if (space) {
+#ifdef STELLA_COMPRESSED_REFS
+        give_range(space, space_mapped_size(size, page_kind));
+#else
+        munmap(space, space_mapped_size(size, page_kind));
+#endif
+    }
+}
+
+/** Return the whole pages of [start, start + size) to the OS as current_state.release_policy says.
+ * Their contents are lost (read as zeros or as before, depending on the policy and memory pressure).
+ */
+static void space_release(void *start, size_t size) {
+    if (current_state.release_policy == GC_RELEASE_NONE) {
+        return;
+    }
+    uintptr_t unit = space_unit(current_state.page_kind);
+    uintptr_t from = ((uintptr_t) start + unit - 1) & ~(unit - 1);
+    uintptr_t to = ((uintptr_t) start + size) & ~(unit - 1);
+    if (from >= to) {
+        return;
+    }
+    int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+    if (current_state.release_policy == GC_RELEASE_LAZY) {
+        advice = MADV_FREE;
+    }
+#endif
+    if (!madvise((void *) from, to - from, advice)) {
+        current_state.released_bytes += to - from;
+    }
+}
+
+/** Index of the first large object at or above p.
+ */
+static size_t large_object_index(void *p) {
+    size_t lo = 0, hi = current_state.large_objects_size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((uintptr_t) current_state.large_objects[mid].address < (uintptr_t) p) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/** The large object starting at p, or NULL if p is not one.
+ */
+static gc_large_object *find_large_object(void *p) {
+    size_t size = current_state.large_objects_size;
+    if (!size || (uintptr_t) p < (uintptr_t) current_state.large_objects[0].address
+        || (uintptr_t) p > (uintptr_t) current_state.large_objects[size - 1].address) {
+        return NULL;
+    }
+    size_t i = large_object_index(p);
+    return i < size && current_state.large_objects[i].address == p ? &current_state.large_objects[i] : NULL;
+}
+
+/** Push a marked object whose fields are still to be scanned.
+ */
+static void push_gray(void *p) {
+    if (current_state.gray_size == current_state.gray_capacity) {
+        size_t capacity = MAX(LARGE_OBJECTS_INITIAL_CAPACITY, 2 * current_state.gray_capacity);
+        current_state.gray_objects = realloc(current_state.gray_objects, capacity * sizeof(void *));
+        current_state.gray_capacity = capacity;
+    }
+    current_state.gray_objects[current_state.gray_size++] = p;
+}
+
+/** Mark p if it is a large object not yet reached in this cycle.
+ * Its fields are scanned later, after the copied objects (see scan).
+ */
+static void mark_large_object(void *p) {
+    gc_large_object *large = find_large_object(p);
+    if (!large || large->marked) {
+        return;
+    }
+
+    large->marked = true;
+#ifdef STELLA_GC_PROFILE
+    census((stella_object *) p);
+#endif
+    push_gray(p);
+}
+
+/** Free the large objects which were not reached in this cycle and unmark the others.
+ */
+static void sweep_large_objects() {
+    size_t kept = 0;
+    for (size_t i = 0; i < current_state.large_objects_size; i++) {
+        gc_large_object large = current_state.large_objects[i];
+        if (large.marked) {
+            large.marked = false;
+            current_state.large_objects[kept++] = large;
+        } else {
+            current_state.large_objects_bytes -= large.size;
+            GC_STATS_CYCLE(stats.large_objects_freed++;)
+#ifdef STELLA_COMPRESSED_REFS
+            reservation_free(large.address, large.size);
+#else
+            free(large.address);
+#endif
+        }
+    }
+    current_state.large_objects_size = kept;
+    current_state.large_allocated_since_flip = 0;
+}
+
+#ifdef STELLA_GC_CONSERVATIVE
+
+/* Mostly-copying collection (Bartlett). The native stack of the mutator and its registers are scanned
+ * for ambiguous roots: words which look like pointers into from-space or into a run pinned by an earlier
+ * cycle. Such a word may just as well be an integer or a stale value, so it is left as it is and what
+ * it points to is not moved. Pinning is by page: every object starting on a page an ambiguous root
+ * points into stays in place and gets its fields scanned like a root, the rest is copied as usual
+ * (the roots of the shadow stack are precise). At the flip the evacuated space is unmapped but for
+ * the pages of the pinned runs, which the next cycle evacuates in turn unless they are pinned again.
+ * The object an ambiguous root points into is found by walking its page from the object holding the
+ * first byte of the page, which the allocator and the copy record for every page (Bartlett's page
+ * table). As every cycle copies into a fresh mapping, a field not initialized yet reads as NULL.
+ */
+
+/** Top of the native stack of the calling thread.
+ */
+static void *native_stack_base() {
+    pthread_attr_t attr;
+    void *stack = NULL;
+    size_t size = 0;
+    if (!pthread_getattr_np(pthread_self(), &attr)) {
+        pthread_attr_getstack(&attr, &stack, &size);
+        pthread_attr_destroy(&attr);
+    }
+    if (!stack) {
+        fprintf(stderr, "Cannot find the native stack to scan for roots\n");
+        exit(-1);
+    }
+    return (char *) stack + size;
+}
+
+/** The run pinned by an earlier cycle which holds p, or NULL.
+ */
+static gc_pinned_run *find_pinned_run(void *p) {
+    size_t size = current_state.pinned_runs_size;
+    if (!size || (char *) p < (char *) current_state.pinned_runs[0].first
+        || (char *) p >= (char *) current_state.pinned_runs[size - 1].end) {
+        return NULL;
+    }
+    size_t lo = 0, hi = size;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((char *) current_state.pinned_runs[mid].first <= (char *) p) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    gc_pinned_run *run = &current_state.pinned_runs[lo];
+    return (char *) p < (char *) run->end ? run : NULL;
+}
+
+/** The large object p points into, or NULL.
+ */
+static gc_large_object *find_large_object_containing(void *p) {
+    size_t i = large_object_index((char *) p + 1);
+    if (!i) {
+        return NULL;
+    }
+    gc_large_object *large = &current_state.large_objects[i - 1];
+    return (char *) p < (char *) large->address + large->size ? large : NULL;
+}
+
+static void add_ambiguous_root(void *p) {
+    if (current_state.ambiguous_size == current_state.ambiguous_capacity) {
+        size_t capacity = MAX(ROOT_STACK_INITIAL_CAPACITY, 2 * current_state.ambiguous_capacity);
+        current_state.ambiguous_roots = realloc(current_state.ambiguous_roots, capacity * sizeof(void *));
+        current_state.ambiguous_capacity = capacity;
+    }
+    current_state.ambiguous_roots[current_state.ambiguous_size++] = p;
+}
+
+/** Collect the words between the frame of this function and the stack base which point into from-space
+ * or into a pinned run, and mark the large objects the others point into.
+ * The words are read as they are, whatever the address sanitizer thinks of the frames they belong to.
+ */
+static GC_NOINLINE GC_NO_SANITIZE_ADDRESS void scan_native_stack() {
+    char *from_space = (char *) current_state.from_space, *next = (char *) current_state.next;
+    size_t runs = current_state.pinned_runs_size, larges = current_state.large_objects_size;
+    char *runs_start = runs ? (char *) current_state.pinned_runs[0].first : NULL;
+    char *runs_end = runs ? (char *) current_state.pinned_runs[runs - 1].end : NULL;
+    char *large_start = larges ? (char *) current_state.large_objects[0].address : NULL;
+    char *large_end = larges ? (char *) current_state.large_objects[larges - 1].address
+                               + current_state.large_objects[larges - 1].size : NULL;
+
+    void *here = NULL;
+    for (void **word = &here; word < (void **) current_state.stack_base; word++) {
+        char *p = (char *) *word;
+        if ((from_space <= p && p < next) || (runs_start <= p && p < runs_end && find_pinned_run(p))) {
+            add_ambiguous_root(p);
+        } else if (large_start <= p && p < large_end) {
+            gc_large_object *large = find_large_object_containing(p);
+            if (large) {
+                mark_large_object(large->address);
+            }
+        }
+    }
+}
+
+/** Record obj, of size bytes, in the table of object starts of the space at base,
+ * for every page whose first byte it holds.
+ */
+static inline void note_object_start(void **starts, void *base, void *obj, size_t size) {
+    size_t shift = current_state.page_shift;
+    uintptr_t offset = (uintptr_t) obj - (uintptr_t) base;
+    uintptr_t last = (offset + size - 1) >> shift;
+    for (uintptr_t page = (offset + ((uintptr_t) 1 << shift) - 1) >> shift; page <= last; page++) {
+        starts[page] = obj;
+    }
+}
+
+/** Resize the table of object starts of a space of size bytes (entries not yet recorded are garbage).
+ */
+static void **resize_object_starts(void **starts, size_t size) {
+    starts = realloc(starts, ((size >> current_state.page_shift) + 1) * sizeof(void *));
+    if (!starts) {
+        out_of_memory();
+    }
+    return starts;
+}
+
+static int compare_addresses(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) *(void *const *) a, y = (uintptr_t) *(void *const *) b;
+    return (x > y) - (x < y);
+}
+
+static int compare_runs(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) ((const gc_pinned_run *) a)->first, y = (uintptr_t) ((const gc_pinned_run *) b)->first;
+    return (x > y) - (x < y);
+}
+
+/** Index of the first ambiguous root at or above p (they are sorted).
+ */
+static size_t ambiguous_root_index(void *p) {
+    size_t lo = 0, hi = current_state.ambiguous_size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((uintptr_t) current_state.ambiguous_roots[mid] < (uintptr_t) p) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/** Keep obj in place: it is scanned with the marked large objects, forward returns it as is.
+ */
+static void pin_object(stella_object *obj) {
+    obj->object_header |= GC_HEADER_MARKED;
+#ifdef STELLA_GC_PROFILE
+    census(obj);
+#endif
+    GC_STATS_CYCLE(stats.pinned_bytes += GC_HEAP_OBJ_SIZE(obj);)
+    push_gray(obj);
+}
+
+static void add_pinned_run(char *first, char *end) {
+    if (current_state.new_pinned_size == current_state.new_pinned_capacity) {
+        size_t capacity = MAX(LARGE_OBJECTS_INITIAL_CAPACITY, 2 * current_state.new_pinned_capacity);
+        current_state.new_pinned_runs = realloc(current_state.new_pinned_runs, capacity * sizeof(gc_pinned_run));
+        current_state.new_pinned_capacity = capacity;
+    }
+    gc_pinned_run *run = &current_state.new_pinned_runs[current_state.new_pinned_size++];
+    run->first = first;
+    run->end = end;
+}
+
+/** Pin every object of [start, end) which starts on the pages [lo, hi] of base, in runs of adjacent objects
+ * (those from first_run on were pinned in the same space).
+ */
+static void pin_page_range(char *start, char *end, char *base, void **starts, size_t lo, size_t hi, size_t first_run) {
+    size_t shift = current_state.page_shift;
+    char *pages = base + (lo << shift), *pages_end = base + ((hi + 1) << shift);
+    for (char *obj = starts[lo]; obj < end && obj < pages_end;) {
+        char *obj_end = obj + GC_HEAP_OBJ_SIZE((stella_object *) obj);
+        if (obj >= pages && obj >= start) {
+            pin_object((stella_object *) obj);
+            size_t runs = current_state.new_pinned_size;
+            if (runs > first_run && current_state.new_pinned_runs[runs - 1].end == obj) {
+                current_state.new_pinned_runs[runs - 1].end = obj_end;
+            } else {
+                add_pinned_run(obj, obj_end);
+            }
+        }
+        obj = obj_end;
+    }
+}
+
+/** Pin the objects of [start, end), a sequence of adjacent objects on the pages [base, base + size),
+ * which start on the pages holding the objects the count (sorted) ambiguous roots point into.
+ * starts[i] is the object holding the first byte of page i, or the first object if that is on page i.
+ */
+static void pin_pages(char *start, char *end, char *base, size_t size, void **starts, void **roots, size_t count) {
+    size_t shift = current_state.page_shift;
+    size_t first_run = current_state.new_pinned_size;
+    char *obj = start;
+    size_t lo = 0, hi = 0;
+    bool pending = false;
+    for (size_t i = 0; i < count; i++) {
+        // the object the root points into, found from the start of its page
+        char *root = (char *) roots[i];
+        obj = MAX(obj, (char *) starts[(root - base) >> shift]);
+        char *obj_end = obj + GC_HEAP_OBJ_SIZE((stella_object *) obj);
+        while (obj_end <= root) {
+            obj = obj_end;
+            obj_end = obj + GC_HEAP_OBJ_SIZE((stella_object *) obj);
+        }
+
+        size_t obj_lo = (obj - base) >> shift, obj_hi = (obj_end - 1 - base) >> shift;
+        if (pending && obj_lo <= hi + 1) {
+            hi = MAX(hi, obj_hi);
+            continue;
+        }
+        if (pending) {
+            pin_page_range(start, end, base, starts, lo, hi, first_run);
+        }
+        lo = obj_lo;
+        hi = obj_hi;
+        pending = true;
+    }
+    if (pending) {
+        pin_page_range(start, end, base, starts, lo, hi, first_run);
+    }
+
+    uintptr_t unit = (uintptr_t) 1 << shift;
+    for (size_t i = first_run; i < current_state.new_pinned_size; i++) {
+        gc_pinned_run *run = &current_state.new_pinned_runs[i];
+        run->pages = base + (((char *) run->first - base) & ~(unit - 1));
+        run->pages_size = MIN(((char *) run->end - base + unit - 1) & ~(unit - 1), size) - ((char *) run->pages - base);
+    }
+}
+
+/** Find the ambiguous roots and pin what they point to, before anything is copied.
+ */
+static void pin_ambiguous_roots() {
+    // the callee-saved registers go to this frame, which scan_native_stack sees
+    jmp_buf registers;
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_unwind_init();
+#endif
+    setjmp(registers);
+    current_state.ambiguous_size = 0;
+    scan_native_stack();
+
+    void **roots = current_state.ambiguous_roots;
+    if (current_state.ambiguous_size) {
+        qsort(roots, current_state.ambiguous_size, sizeof(void *), compare_addresses);
+    }
+    GC_STATS_CYCLE(stats.ambiguous_roots += current_state.ambiguous_size;)
+
+    char *from_space = (char *) current_state.from_space;
+    size_t lo = ambiguous_root_index(from_space), hi = ambiguous_root_index(current_state.next);
+    if (lo < hi) {
+        pin_pages(from_space, current_state.next, from_space,
+                  space_mapped_size(current_state.from_space_size, current_state.page_kind),
+                  current_state.from_space_starts, roots + lo, hi - lo);
+    }
+    for (size_t i = 0; i < current_state.pinned_runs_size; i++) {
+        gc_pinned_run run = current_state.pinned_runs[i];
+        lo = ambiguous_root_index(run.first);
+        hi = ambiguous_root_index(run.end);
+        if (lo == hi) {
+            continue;
+        }
+        // runs are short: their table of object starts is made when needed
+        void **starts = calloc((run.pages_size >> current_state.page_shift) + 1, sizeof(void *));
+        if (!starts) {
+            out_of_memory();
+        }
+        starts[((char *) run.first - (char *) run.pages) >> current_state.page_shift] = run.first;
+        for (char *obj = run.first; obj < (char *) run.end; obj += GC_HEAP_OBJ_SIZE((stella_object *) obj)) {
+            note_object_start(starts, run.pages, obj, GC_HEAP_OBJ_SIZE((stella_object *) obj));
+        }
+        pin_pages(run.first, run.end, run.pages, run.pages_size, starts, roots + lo, hi - lo);
+        free(starts);
+    }
+}
+
+/** Unmap the pages of the mapping [start, start + size) which hold none of the runs pinned by this cycle.
+ */
+static void unmap_unpinned(char *start, size_t size) {
+    char *cursor = start;
+    for (size_t i = 0; i < current_state.new_pinned_size; i++) {
+        gc_pinned_run run = current_state.new_pinned_runs[i];
+        if ((char *) run.pages < start || (char *) run.pages >= start + size) {
+            continue;
+        }
+        if ((char *) run.pages > cursor) {
+            munmap(cursor, (char *) run.pages - cursor);
+        }
+        cursor = MAX(cursor, (char *) run.pages + run.pages_size);
+    }
+    if (cursor < start + size) {
+        munmap(cursor, start + size - cursor);
+    }
+}
+
+/** At the flip: free the evacuated space and the earlier runs but for the pages of the runs pinned
+ * by this cycle, which become the pinned runs, unmarked for the next cycle.
+ */
+static void keep_pinned_runs(void *evacuated, size_t evacuated_size) {
+    if (current_state.new_pinned_size) {
+        qsort(current_state.new_pinned_runs, current_state.new_pinned_size, sizeof(gc_pinned_run), compare_runs);
+    }
+    if (evacuated) {
+        unmap_unpinned(evacuated, space_mapped_size(evacuated_size, current_state.page_kind));
+    }
+    for (size_t i = 0; i < current_state.pinned_runs_size; i++) {
+        unmap_unpinned(current_state.pinned_runs[i].pages, current_state.pinned_runs[i].pages_size);
+    }
+
+    gc_pinned_run *runs = current_state.pinned_runs;
+    size_t capacity = current_state.pinned_runs_capacity;
+    current_state.pinned_runs = current_state.new_pinned_runs;
+    current_state.pinned_runs_size = current_state.new_pinned_size;
+    current_state.pinned_runs_capacity = current_state.new_pinned_capacity;
+    current_state.new_pinned_runs = runs;
+    current_state.new_pinned_size = 0;
+    current_state.new_pinned_capacity = capacity;
+
+    current_state.pinned_bytes = 0;
+    for (size_t i = 0; i < current_state.pinned_runs_size; i++) {
+        gc_pinned_run run = current_state.pinned_runs[i];
+        current_state.pinned_bytes += (char *) run.end - (char *) run.first;
+        for (char *obj = run.first; obj < (char *) run.end; obj += GC_HEAP_OBJ_SIZE((stella_object *) obj)) {
+            ((stella_object *) obj)->object_header &= ~GC_HEADER_MARKED;
+        }
+    }
+}
+
+#endif
+
+/** Whether p is in a space the current cycle evacuates: from-space, the nursery
+ * or, in the conservative mode, a run pinned by an earlier cycle.
+ */
+static bool is_condemned(void *p) {
+    if (is_from_space(p) || is_nursery(p)) {
+        return true;
+    }
+#ifdef STELLA_GC_CONSERVATIVE
+    return find_pinned_run(p) != NULL;
+#else
+    return false;
+#endif
+}
+
+#if STELLA_SMALL_NATS > 0
+
+/** The shared object which can stand in for a SUCC object of the_ZERO or of a shared object
+ * (see stella_shared_succ), or NULL. An argument which was evacuated already counts by its copy.
+ */
+static stella_object *shared_succ(stella_object *obj) {
+    if (STELLA_OBJECT_HEADER_TAG(obj->object_header) != TAG_SUCC) {
+        return NULL;
+    }
+    stella_object *n = (stella_object *) STELLA_OBJECT_FIELD(obj, 0);
+    if (is_condemned(n) && n->object_header & GC_HEADER_FORWARDED) {
+        n = (stella_object *) STELLA_OBJECT_FIELD(n, 0);
+    }
+    return stella_shared_succ(n);
+}
+
+#endif
+
+/** Copy a single from-space (or nursery) object to next and mark the original as forwarded:
+ * its header gets GC_HEADER_FORWARDED and its first field the address of the copy.
+ * A SUCC object of a small Nat is forwarded to the shared object instead (see the_SMALL_NATS).
+ */
+static stella_object *copy(void *p) {
+    stella_object *obj = (stella_object *) p;
+#if STELLA_SMALL_NATS > 0
+    stella_object *shared = shared_succ(obj);
+    if (shared) {
+        obj->object_header |= GC_HEADER_FORWARDED;
+        STELLA_OBJECT_SET_FIELD(obj, 0, shared);
+        return shared;
+    }
+#endif
+    stella_object *q = (stella_object *) current_state.next;
+    size_t q_size = GC_HEAP_OBJ_SIZE(obj);
+    if ((char *) q + q_size > (char *) current_state.limit) {
+        out_of_memory();
+    }
+    current_state.next = (char *) q + q_size;
+#ifdef STELLA_GC_CONSERVATIVE
+    note_object_start(current_state.to_space_starts, current_state.to_space, q, q_size);
+#endif
+    GC_STATS_FULL(stats.reads++; stats.writes++;)
+    memcpy(q, p, q_size);
+    q->object_header &= ~GC_HEADER_REMEMBERED;
+#ifdef STELLA_GC_PROFILE
+    census(q);
+#endif
+
+    obj->object_header |= GC_HEADER_FORWARDED;
+    STELLA_OBJECT_SET_FIELD(obj, 0, q);
+    return q;
+}
+
+/** Copy p and then keep copying one not yet forwarded from-space child of the last copy,
+ * so that chains (lists, SUCC cells) end up next to each other in to-space.
+ */
+void chase(void *p) {
+    do {
+        stella_object *q = copy(p);
+        size_t fields_count = STELLA_OBJECT_HEADER_FIELD_COUNT(q->object_header);
+        void *r = NULL;
+        for (size_t i = 0; i < fields_count; i++) {
+            stella_object *child = (stella_object *) STELLA_OBJECT_FIELD(q, i);
+            GC_STATS_FULL(stats.reads++;)
+            if (is_from_space(child) && !(child->object_header & (GC_HEADER_FORWARDED | GC_HEADER_MARKED))) {
+                r = child;
+            }
+        }
+        p = r;
+    } while (p != NULL);
+}
+
+/** Copy p and then, depth first, the not yet forwarded from-space objects reachable from it,
+ * so that an object is followed by its first child and everything below that child
+ * (a list cell by its element, a tree node by its left subtree). At most GC_COPY_STACK_SIZE
+ * objects wait to be copied, the scan copies the children that do not fit.
+ */
+static void copy_depth_first(void *p) {
+    void *pending[GC_COPY_STACK_SIZE];
+    size_t pending_size = 0;
+    pending[pending_size++] = p;
+    while (pending_size) {
+        stella_object *obj = (stella_object *) pending[--pending_size];
+        GC_STATS_FULL(stats.reads++;)
+        if (obj->object_header & GC_HEADER_FORWARDED) {
+            continue; // reached through another parent in the meantime
+        }
+        stella_object *q = copy(obj);
+        size_t fields_count = STELLA_OBJECT_HEADER_FIELD_COUNT(q->object_header);
+        // pushed last to first, so that the first child is copied next
+        for (size_t i = fields_count; i-- > 0 && pending_size < GC_COPY_STACK_SIZE;) {
+            stella_object *child = (stella_object *) STELLA_OBJECT_FIELD(q, i);
+            GC_STATS_FULL(stats.reads++;)
+            if (is_from_space(child) && !(child->object_header & (GC_HEADER_FORWARDED | GC_HEADER_MARKED))) {
+                pending[pending_size++] = child;
+            }
+        }
+    }
+}
+
+/** Returns the to-space address of p, evacuating it first if necessary.
+ * Anything outside of from-space and the nursery (static objects, to-space objects,
+ * large objects, code pointers, immediate Nats) is returned as is; large objects get marked.
+ * So are pinned objects (STELLA_GC_CONSERVATIVE).
+ */
+void *forward(void *p) {
+    if (!is_condemned(p)) {
+        mark_large_object(p);
+        return p;
+    }
+
+    stella_object *obj = (stella_object *) p;
+    GC_STATS_FULL(stats.reads++;)
+    if (obj->object_header & GC_HEADER_FORWARDED) {
+        return STELLA_OBJECT_FIELD(obj, 0);
+    }
+#ifdef STELLA_GC_CONSERVATIVE
+    if (obj->object_header & GC_HEADER_MARKED) {
+        return p;
+    }
+#endif
+    if (is_from_space(p)) {
+        switch (current_state.copy_order) {
+            case GC_COPY_CHASE:
+                chase(p);
+                return STELLA_OBJECT_FIELD(obj, 0);
+            case GC_COPY_DEPTH:
+                copy_depth_first(p);
+                return STELLA_OBJECT_FIELD(obj, 0);
+            default:
+                break;
+        }
+    }
+    return copy(p);
+}
+
+
+#ifdef STELLA_GC_PARALLEL
+
+/* Parallel evacuation. Every worker (the collecting thread is worker 0) copies into its own buffer
+ * claimed from to-space and keeps the copies it still has to scan in a work-stealing deque
+ * (Chase and Lev), which idle workers steal from. Two workers may race to evacuate the same object:
+ * the one whose CAS sets GC_HEADER_BUSY copies it and then publishes GC_HEADER_FORWARDED,
+ * the other waits for the forwarding address.
+ * The copy buffers leave gaps without object headers in to-space (see worker_alloc), so after
+ * a parallel cycle to-space cannot be walked from object to object. Nothing does so with the cheney
+ * backend: sequential cycles trace from the roots, and the modes which walk spaces linearly
+ * (the compact backend, the pinned runs of STELLA_GC_CONSERVATIVE) cannot be combined with it.
+ * The per-access counters of the FULL statistics level are not kept during parallel evacuation.
+ */
+
+/** Pauses a worker spins for while another one copies an object it needs, before it yields. */
+#define GC_BUSY_SPINS 64
+
+typedef struct Gc_deque_array {
+    ptrdiff_t capacity;
+    struct Gc_deque_array *previous;  /**< Outgrown array, thieves may still read it until the cycle ends. */
+    void *items[];
+} gc_deque_array;
+
+typedef struct Gc_worker {
+    size_t index;
+    char *next, *limit;               /**< Copy buffer. */
+    ptrdiff_t top, bottom;
+    gc_deque_array *array;
+    gc_worker_stats cycle;            /**< Work done in the current cycle (added to stats at its end). */
+    pthread_t thread;
+} gc_worker;
+
+static struct {
+    size_t size;                      /**< Number of workers, including the collecting thread. */
+    gc_worker workers[GC_MAX_WORKERS];
+    pthread_once_t once;
+    pthread_mutex_t busy;             /**< Held by the thread whose cycle the workers evacuate. */
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    size_t cycle, finished;
+    size_t active;                    /**< Workers which may still produce work. */
+    gc_context *context;              /**< The heap being evacuated. */
+} pool = {
+        .size = 1,
+        .once = PTHREAD_ONCE_INIT,
+        .busy = PTHREAD_MUTEX_INITIALIZER,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .start = PTHREAD_COND_INITIALIZER,
+        .done = PTHREAD_COND_INITIALIZER,
+        .cycle = 0,
+        .finished = 0,
+        .active = 0,
+        .context = NULL,
+};
+
+static gc_deque_array *deque_array(ptrdiff_t capacity, gc_deque_array *previous) {
+    gc_deque_array *array = malloc(sizeof(gc_deque_array) + (size_t) capacity * sizeof(void *));
+    if (!array) {
+        out_of_memory();
+    }
+    array->capacity = capacity;
+    array->previous = previous;
+    return array;
+}
+
+/** Push p at the bottom of the worker's own deque.
+ */
+static void deque_push(gc_worker *worker, void *p) {
+    ptrdiff_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+    ptrdiff_t top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    gc_deque_array *array = worker->array;
+    if (bottom - top >= array->capacity) {
+        gc_deque_array *grown = deque_array(2 * array->capacity, array);
+        for (ptrdiff_t i = top; i < bottom; i++) {
+            grown->items[i % grown->capacity] = __atomic_load_n(&array->items[i % array->capacity], __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&worker->array, grown, __ATOMIC_RELEASE);
+        array = grown;
+    }
+    __atomic_store_n(&array->items[bottom % array->capacity], p, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+/** Pop from the bottom of the worker's own deque. Returns NULL if it is empty.
+ */
+static void *deque_take(gc_worker *worker) {
+    ptrdiff_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+    gc_deque_array *array = worker->array;
+    __atomic_store_n(&worker->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    ptrdiff_t top = __atomic_load_n(&worker->top, __ATOMIC_RELAXED);
+    if (top > bottom) {
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    void *p = __atomic_load_n(&array->items[bottom % array->capacity], __ATOMIC_RELAXED);
+    if (top == bottom) {
+        // the last item: race the thieves for it
+        if (!__atomic_compare_exchange_n(&worker->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            p = NULL;
+        }
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return p;
+}
+
+/** Take from the top of another worker's deque. Returns NULL if it is empty or another thief was faster.
+ */
+static void *deque_steal(gc_worker *victim) {
+    ptrdiff_t top = __atomic_load_n(&victim->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    ptrdiff_t bottom = __atomic_load_n(&victim->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return NULL;
+    }
+    gc_deque_array *array = __atomic_load_n(&victim->array, __ATOMIC_ACQUIRE);
+    void *p = __atomic_load_n(&array->items[top % array->capacity], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&victim->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return p;
+}
+
+/** Claim between min_size and size bytes at the shared next pointer of to-space.
+ * The end of the claimed range is stored in end.
+ */
+static char *claim_to_space(size_t min_size, size_t size, char **end) {
+    void *start = __atomic_load_n(&current_state.next, __ATOMIC_RELAXED);
+    char *stop;
+    do {
+        size_t left = (size_t) ((char *) current_state.limit - (char *) start);
+        if (left < min_size) {
+            out_of_memory();
+        }
+        stop = (char *) start + MIN(size, left);
+    } while (!__atomic_compare_exchange_n(&current_state.next, &start, (void *) stop, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    *end = stop;
+    return (char *) start;
+}
+
+/** Room for a copy of size bytes. The copy buffer is refilled only when its rest is small
+ * (less than 1/512 of a buffer), bigger objects which do not fit are claimed from to-space directly.
+ * The rest of a refilled buffer is left as it is: a gap that no header describes.
+ */
+static char *worker_alloc(gc_worker *worker, size_t size) {
+    if (worker->next + size > worker->limit) {
+        char *end;
+        if ((size_t) (worker->limit - worker->next) >= GC_PARALLEL_CHUNK_SIZE / 512
+            || size > GC_PARALLEL_CHUNK_SIZE / 4) {
+            return claim_to_space(size, size, &end);
+        }
+        worker->next = claim_to_space(size, GC_PARALLEL_CHUNK_SIZE, &worker->limit);
+    }
+    char *p = worker->next;
+    worker->next += size;
+    return p;
+}
+
+static void worker_mark_large_object(gc_worker *worker, void *p) {
+    gc_large_object *large = find_large_object(p);
+    if (large && !__atomic_exchange_n(&large->marked, true, __ATOMIC_ACQ_REL)) {
+        deque_push(worker, p);
+    }
+}
+
+/** The parallel counterpart of forward.
+ */
+static void *worker_forward(gc_worker *worker, void *p) {
+    if (!is_from_space(p)) {
+        worker_mark_large_object(worker, p);
+        return p;
+    }
+
+    stella_object *obj = (stella_object *) p;
+    int header = __atomic_load_n(&obj->object_header, __ATOMIC_ACQUIRE);
+    size_t spins = 0;
+    while (!(header & GC_HEADER_FORWARDED)) {
+        if (header & GC_HEADER_BUSY) {
+            // the copy takes a moment, unless the worker making it was preempted
+            if (++spins < GC_BUSY_SPINS) {
+                GC_SPIN_PAUSE();
+            } else {
+                sched_yield();
+            }
+            header = __atomic_load_n(&obj->object_header, __ATOMIC_ACQUIRE);
+        } else if (__atomic_compare_exchange_n(&obj->object_header, &header, header | GC_HEADER_BUSY, false,
+                                               __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+#if STELLA_SMALL_NATS > 0
+            // only the argument as it is: another worker may be evacuating it
+            stella_object *shared = STELLA_OBJECT_HEADER_TAG(header) == TAG_SUCC
+                                    ? stella_shared_succ((stella_object *) STELLA_OBJECT_FIELD(obj, 0)) : NULL;
+            if (shared) {
+                __atomic_store_n(&obj->object_fields[0], STELLA_FIELD_ENCODE(shared), __ATOMIC_RELAXED);
+                __atomic_store_n(&obj->object_header, header | GC_HEADER_FORWARDED, __ATOMIC_RELEASE);
+                return shared;
+            }
+#endif
+            size_t size = GC_HEAP_OBJ_SIZE(obj);
+            stella_object *q = (stella_object *) worker_alloc(worker, size);
+            memcpy(q, obj, size);
+            q->object_header = header;
+            __atomic_store_n(&obj->object_fields[0], STELLA_FIELD_ENCODE(q), __ATOMIC_RELAXED);
+            __atomic_store_n(&obj->object_header, header | GC_HEADER_FORWARDED, __ATOMIC_RELEASE);
+            worker->cycle.copied_bytes += size;
+            worker->cycle.copied++;
+            deque_push(worker, q);
+            return q;
+        }
+    }
+    return STELLA_FIELD_DECODE(__atomic_load_n(&obj->object_fields[0], __ATOMIC_RELAXED));
+}
+
+static void *steal_work(gc_worker *worker) {
+    for (size_t i = 1; i < pool.size; i++) {
+        void *p = deque_steal(&pool.workers[(worker->index + i) % pool.size]);
+        if (p) {
+            worker->cycle.steals++;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static bool work_left() {
+    for (size_t i = 0; i < pool.size; i++) {
+        gc_worker *worker = &pool.workers[i];
+        if (__atomic_load_n(&worker->top, __ATOMIC_ACQUIRE) < __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Forward the worker's share of the roots, then scan copies until no worker has any left.
+ * A worker only becomes inactive with an empty deque, so once no worker is active the cycle is over.
+ */
+static void evacuate(gc_worker *worker) {
+    for (size_t i = worker->index; i < current_state.roots_size; i += pool.size) {
+        *current_state.roots[i] = worker_forward(worker, *current_state.roots[i]);
+    }
+    for (;;) {
+        void *p;
+        while ((p = deque_take(worker)) || (p = steal_work(worker))) {
+            stella_object *obj = (stella_object *) p;
+            size_t field_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+            for (size_t i = 0; i < field_count; i++) {
+                STELLA_OBJECT_SET_FIELD(obj, i, worker_forward(worker, STELLA_OBJECT_FIELD(obj, i)));
+            }
+            worker->cycle.scanned++;
+        }
+
+        __atomic_sub_fetch(&pool.active, 1, __ATOMIC_SEQ_CST);
+        while (!work_left()) {
+            if (!__atomic_load_n(&pool.active, __ATOMIC_SEQ_CST)) {
+                return;
+            }
+            sched_yield();
+        }
+        __atomic_add_fetch(&pool.active, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void *worker_main(void *arg) {
+    gc_worker *worker = (gc_worker *) arg;
+    size_t cycle = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool.lock);
+        while (pool.cycle == cycle) {
+            pthread_cond_wait(&pool.start, &pool.lock);
+        }
+        cycle = pool.cycle;
+#ifdef STELLA_GC_CONTEXTS
+        gc_bound_context = pool.context;
+#endif
+        pthread_mutex_unlock(&pool.lock);
+
+        evacuate(worker);
+
+        pthread_mutex_lock(&pool.lock);
+        if (++pool.finished == pool.size - 1) {
+            pthread_cond_signal(&pool.done);
+        }
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+/** Start the worker threads: STELLA_GC_THREADS of them (the online CPUs by default), at most GC_MAX_WORKERS.
+ */
+static void start_workers() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t size = cpus > 0 ? (size_t) cpus : 1;
+    const char *threads = getenv("STELLA_GC_THREADS");
+    if (threads && strtoul(threads, NULL, 10) > 0) {
+        size = strtoul(threads, NULL, 10);
+    }
+    size = MIN(size, GC_MAX_WORKERS);
+
+    for (size_t i = 0; i < size; i++) {
+        pool.workers[i].index = i;
+        pool.workers[i].array = deque_array(GC_DEQUE_INITIAL_CAPACITY, NULL);
+    }
+    while (pool.size < size && !pthread_create(&pool.workers[pool.size].thread, NULL, worker_main,
+                                               &pool.workers[pool.size])) {
+        pool.size++;
+    }
+}
+
+/** Evacuate everything reachable from the roots with all workers. Called with to-space set up
+ * by collect_garbage; on return next is past the last claimed copy buffer.
+ */
+static void parallel_evacuate() {
+    pthread_mutex_lock(&pool.busy);
+    for (size_t i = 0; i < pool.size; i++) {
+        gc_worker *worker = &pool.workers[i];
+        worker->next = worker->limit = NULL;
+        worker->top = worker->bottom = 0;
+        memset(&worker->cycle, 0, sizeof worker->cycle);
+    }
+    pool.active = pool.size;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.context = GC_CONTEXT;
+    pool.finished = 0;
+    pool.cycle++;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    evacuate(&pool.workers[0]);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.finished < pool.size - 1) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    for (size_t i = 0; i < pool.size; i++) {
+        gc_worker *worker = &pool.workers[i];
+        while (worker->array->previous) {
+            gc_deque_array *previous = worker->array->previous;
+            worker->array->previous = previous->previous;
+            free(previous);
+        }
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+        stats.workers[i].copied_bytes += worker->cycle.copied_bytes;
+        stats.workers[i].copied += worker->cycle.copied;
+        stats.workers[i].scanned += worker->cycle.scanned;
+        stats.workers[i].steals += worker->cycle.steals;
+#endif
+    }
+    GC_STATS_CYCLE(stats.parallel_cycles++;)
+    pthread_mutex_unlock(&pool.busy);
+}
+
+#endif
+
+/** Bytes taken in from-space: copied objects below next and allocated objects above limit
+ * (but for the free bytes a shrinking flip hid there).
+ * The conservative mode allocates nothing above limit, but the next cycle may copy the pinned runs.
+ */
+static size_t from_space_used() {
+#ifdef STELLA_GC_CONSERVATIVE
+    return ((char *) current_state.next - (char *) current_state.from_space) + current_state.pinned_bytes;
+#else
+    return ((char *) current_state.next - (char *) current_state.from_space)
+           + ((char *) current_state.from_space + current_state.from_space_size - (char *) current_state.limit)
+           - current_state.hidden_bytes;
+#endif
+}
+
+/** The FULL level counts every allocation in gc_alloc. The CHEAP level keeps the mutator fast path
+ * untouched instead: the bytes bump-allocated since alloc_mark are added to the total whenever
+ * a collection starts or the statistics are reported.
+ */
+static void account_allocation() {
+#if STELLA_GC_STATS_LEVEL == STELLA_GC_STATS_CHEAP
+#ifdef STELLA_GC_GENERATIONAL
+    stats.total_allocated_bytes += (char *) current_state.nursery_next - (char *) current_state.alloc_mark;
+    current_state.alloc_mark = current_state.nursery_next;
+#else
+    if (current_state.gc_running) {
+        // during a cycle objects are allocated downwards from limit
+        stats.total_allocated_bytes += (char *) current_state.alloc_mark - (char *) current_state.limit;
+        current_state.alloc_mark = current_state.limit;
+    } else {
+        stats.total_allocated_bytes += (char *) current_state.next - (char *) current_state.alloc_mark;
+        current_state.alloc_mark = current_state.next;
+    }
+#endif
+#endif
+}
+
+/** Residency is the number of bytes allocated since the last flip.
+ */
+static void update_residency() {
+    account_allocation();
+    stats.residency_bytes = stats.total_allocated_bytes - current_state.allocated_at_flip;
+}
+
+/** Start a cycle. To-space is sized by the adaptive policy (heap_target_size), but never smaller
+ * than what from-space holds, and it gets headroom more bytes when the caller needs them right away.
+ */
+void collect_garbage(size_t headroom) {
+    account_allocation();
+    current_state.cycle_start_ns = trace_begin();
+    GC_PROBE1(cycle__start, current_state.from_space_size);
+    current_state.gc_running = true;
+    size_t from_used = from_space_used();
+    size_t to_space_size = MAX(current_state.heap_target_size, from_used + headroom);
+#if defined(STELLA_GC_BACKEND_INCREMENTAL) && !defined(STELLA_GC_GENERATIONAL)
+    // room for what the mutator allocates during the cycle: at most the scanned bytes over work_ratio,
+    // where the scan copies about the live data of the last cycle (all of from-space before the first one)
+    size_t live = current_state.live_at_flip ? MIN(current_state.live_at_flip, from_used) : from_used;
+    size_t allowance = (size_t) ((double) live / current_state.work_ratio);
+    to_space_size = MAX(to_space_size, from_used + headroom + allowance);
+#endif
+#ifdef STELLA_GC_PARALLEL
+    current_state.parallel_cycle = pool.size > 1 && from_used >= GC_PARALLEL_MIN_HEAP;
+    if (current_state.parallel_cycle) {
+        // copy buffers leave gaps: the skipped rests of refilled buffers and the unused ends of the last ones
+        to_space_size = MAX(to_space_size, from_used + headroom + from_used / 256 + pool.size * GC_PARALLEL_CHUNK_SIZE);
+    }
+#endif
+#ifdef STELLA_GC_CONSERVATIVE
+    // the pinned runs count against the limit: else every cycle of a full heap keeps a few more pages
+    // pinned and frees room for a few more objects, and the heap creeps past the limit without failing
+    if (from_used > current_state.heap_max_size) {
+        out_of_memory();
+    }
+#endif
+    to_space_size = MAX(MIN(to_space_size, current_state.heap_max_size), from_used);
+    if (to_space_size != current_state.to_space_size) {
+        space_free(current_state.to_space, current_state.to_space_size, current_state.page_kind);
+        current_state.to_space = space_alloc(to_space_size);
+        current_state.to_space_size = to_space_size;
+        if (!current_state.to_space) {
+            out_of_memory();
+        }
+#ifdef STELLA_GC_CONSERVATIVE
+        current_state.to_space_starts = resize_object_starts(current_state.to_space_starts, to_space_size);
+#endif
+    }
+    if (to_space_size != current_state.from_space_size) {
+        trace_end(GC_TRACE_RESIZE, trace_begin(), current_state.from_space_size, to_space_size);
+        GC_PROBE2(heap__resize, current_state.from_space_size, to_space_size);
+    }
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    if (to_space_size > current_state.from_space_size) {
+        stats.heap_grows++;
+    } else if (to_space_size < current_state.from_space_size) {
+        stats.heap_shrinks++;
+    }
+    stats.heap_size = to_space_size;
+    stats.peak_heap_size = MAX(stats.peak_heap_size, to_space_size);
+#endif
+
+#ifdef STELLA_GC_CONSERVATIVE
+    // while next still bounds the objects of from-space
+    uint64_t pin_traced = trace_begin();
+    GC_PROBE(roots__start);
+    GC_STATS_CYCLE(uint64_t pin_start = now_ns();)
+    pin_ambiguous_roots();
+    GC_STATS_CYCLE(stats.root_forwarding_ns += now_ns() - pin_start;)
+    trace_end(GC_TRACE_ROOTS, pin_traced, current_state.ambiguous_size, 0);
+    GC_PROBE1(roots__done, current_state.ambiguous_size);
+#endif
+    current_state.evacuation_reserve = from_used;
+    current_state.headroom = headroom;
+    current_state.next = current_state.to_space;
+    current_state.scan = current_state.to_space;
+    current_state.limit = (char *) current_state.to_space + current_state.to_space_size;
+#ifndef STELLA_GC_GENERATIONAL
+    current_state.alloc_mark = current_state.limit;
+#endif
+#ifdef STELLA_GC_PARALLEL
+    if (current_state.parallel_cycle) {
+        return; // the workers forward the roots (see finish_collection)
+    }
+#endif
+
+    uint64_t roots_traced = trace_begin();
+    GC_PROBE(roots__start);
+    GC_STATS_CYCLE(uint64_t start = now_ns();)
+    for (size_t i = 0; i < current_state.roots_size; i++) {
+        *current_state.roots[i] = forward(*current_state.roots[i]);
+    }
+    GC_STATS_CYCLE(stats.root_forwarding_ns += now_ns() - start;)
+    trace_end(GC_TRACE_ROOTS, roots_traced, current_state.roots_size, 0);
+    GC_PROBE1(roots__done, current_state.roots_size);
+}
+
+/** Statistics of a completed cycle.
+ */
+static void end_cycle_stats() {
+#ifdef STELLA_GC_PROFILE
+    profile_sample("major");
+#endif
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    update_residency();
+    stats.gc_cycles++;
+    stats.major_gc_cycles++;
+    stats.maximum_residency = MAX(stats.maximum_residency, stats.residency);
+    stats.maximum_residency_bytes = MAX(stats.maximum_residency_bytes, stats.residency_bytes);
+    stats.residency = 0;
+    stats.residency_bytes = 0;
+    current_state.allocated_at_flip = stats.total_allocated_bytes;
+#endif
+}
+
+/** Target heap size for live bytes of live data (see HEAP_OCCUPANCY_FACTOR).
+ */
+static size_t heap_target(size_t live) {
+    size_t target = (size_t) ((double) live * current_state.heap_occupancy);
+    return MIN(MAX(target, current_state.heap_initial_size), current_state.heap_max_size);
+}
+
+#ifndef STELLA_GC_BACKEND_COMPACT
+
+/** Whether the cycle still has objects to scan: copied objects between scan and next
+ * or marked large objects.
+ */
+static bool scan_pending() {
+    return current_state.scan < current_state.next || current_state.gray_size;
+}
+
+/** Start loading the from-space objects referenced by the copied object obj, which is scanned soon.
+ */
+static void prefetch_children(stella_object *obj) {
+    size_t field_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+    for (size_t i = 0; i < field_count; i++) {
+        void *field = STELLA_OBJECT_FIELD(obj, i);
+        if (is_from_space(field)) {
+            GC_PREFETCH(field);
+        }
+    }
+}
+
+/** Scan at least size_in_bytes bytes of copied objects, then of marked large objects
+ * (or until nothing is left to scan). Returns the number of bytes scanned.
+ */
+static size_t scan(size_t size_in_bytes) {
+    size_t scanned = 0;
+    // the copied object whose children get prefetched, prefetch_distance objects ahead of scan
+    char *ahead = (char *) current_state.scan;
+    for (size_t i = 0; i < current_state.prefetch_distance && ahead < (char *) current_state.next; i++) {
+        prefetch_children((stella_object *) ahead);
+        ahead += GC_HEAP_OBJ_SIZE((stella_object *) ahead);
+    }
+    while (scanned < size_in_bytes && scan_pending()) {
+        GC_STATS_FULL(stats.reads++;)
+        stella_object *obj;
+        size_t obj_size;
+        if (current_state.scan < current_state.next) {
+            obj = (stella_object *) current_state.scan;
+            obj_size = GC_HEAP_OBJ_SIZE(obj);
+            current_state.scan = (char *) current_state.scan + obj_size;
+            // ahead may not pass next: there is no object header to read there
+            ahead = MAX(ahead, (char *) current_state.scan);
+            if (current_state.prefetch_distance && ahead < (char *) current_state.next) {
+                prefetch_children((stella_object *) ahead);
+                ahead += GC_HEAP_OBJ_SIZE((stella_object *) ahead);
+            }
+        } else {
+            obj = (stella_object *) current_state.gray_objects[--current_state.gray_size];
+            obj_size = GC_OBJ_SIZE(obj);
+        }
+        size_t field_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+        for (size_t i = 0; i < field_count; i++) {
+            void *field = STELLA_OBJECT_FIELD(obj, i);
+            GC_STATS_FULL(stats.reads++;)
+            if (is_condemned(field)) {
+                GC_STATS_FULL(stats.writes++;)
+                STELLA_OBJECT_SET_FIELD(obj, i, forward(field));
+            } else {
+                mark_large_object(field);
+            }
+        }
+        scanned += obj_size;
+    }
+    return scanned;
+}
+
+/** Finish the current cycle: to-space becomes the new from-space.
+ */
+static void flip() {
+    end_cycle_stats();
+    sweep_large_objects();
+
+    current_state.gc_running = false;
+    void *tmp = current_state.from_space;
+    current_state.from_space = current_state.to_space;
+    current_state.to_space = tmp;
+
+    size_t size_tmp = current_state.from_space_size;
+    current_state.from_space_size = current_state.to_space_size;
+    current_state.to_space_size = size_tmp;
+#ifndef STELLA_GC_GENERATIONAL
+    current_state.alloc_mark = current_state.next;
+#endif
+#ifdef STELLA_GC_CONSERVATIVE
+    // only the pinned pages of the evacuated space stay, the next cycle copies into a new mapping
+    keep_pinned_runs(current_state.to_space, current_state.to_space_size);
+    current_state.to_space = NULL;
+    current_state.to_space_size = 0;
+    void **starts = current_state.from_space_starts;
+    current_state.from_space_starts = current_state.to_space_starts;
+    current_state.to_space_starts = starts;
+#endif
+
+    current_state.hidden_bytes = 0;
+    size_t live = from_space_used();
+    current_state.live_at_flip = live;
+    size_t target = heap_target(live);
+    current_state.heap_target_size = target;
+    trace_end(GC_TRACE_FLIP, trace_begin(), live, target);
+    GC_PROBE2(flip, live, target);
+    trace_end(GC_TRACE_CYCLE, current_state.cycle_start_ns, live, current_state.from_space_size);
+    GC_PROBE2(cycle__done, live, current_state.from_space_size);
+    if (target < current_state.from_space_size) {
+        // shrinking: expose only target bytes until the next cycle allocates a smaller to-space,
+        // but keep the headroom the cycle was started for
+        size_t free_bytes = MAX(target > live ? target - live : 0, current_state.headroom);
+        if ((char *) current_state.next + free_bytes < (char *) current_state.limit) {
+            current_state.hidden_bytes = (char *) current_state.limit - ((char *) current_state.next + free_bytes);
+            current_state.limit = (char *) current_state.next + free_bytes;
+            space_release(current_state.limit,
+                          (char *) current_state.from_space + current_state.from_space_size - (char *) current_state.limit);
+        }
+    }
+    // nothing in the evacuated space is needed before the next cycle copies into it
+    space_release(current_state.to_space, current_state.to_space_size);
+}
+
+/** Complete the current cycle without interleaving it with allocation.
+ */
+static void finish_collection() {
+    uint64_t traced = trace_begin();
+    GC_PROBE(finish__start);
+    GC_STATS_CYCLE(uint64_t start = now_ns();)
+    size_t scanned = 0;
+#ifdef STELLA_GC_PARALLEL
+    if (current_state.parallel_cycle) {
+        parallel_evacuate();
+        scanned += (char *) current_state.next - (char *) current_state.scan;
+        current_state.scan = current_state.next;
+    }
+#endif
+    while (scan_pending()) {
+        scanned += scan(SIZE_MAX);
+    }
+    GC_STATS_CYCLE(stats.scan_ns += now_ns() - start;)
+    trace_end(GC_TRACE_FINISH, traced, scanned, 0);
+    GC_PROBE1(finish__done, scanned);
+    flip();
+}
+
+#else
+
+/* The mark-compact backend slides the live objects towards the start of a single heap (Lisp2 style):
+ * 1. mark everything reachable from the roots,
+ * 2. give every marked object its new address, in heap order,
+ * 3. update the roots and the fields of the marked objects (and of the marked large objects),
+ * 4. move the marked objects.
+ * Steps 2 to 4 walk the heap object by object, so an allocated object must have its fields count
+ * initialized before the next allocation (alloc_stella_object does that).
+ * The new offset of a marked object (in words) is kept in the padding between its header and its first field.
+ */
+
+typedef char compact_forwarding_fits_into_padding[
+        offsetof(stella_object, object_fields) >= sizeof(int) + sizeof(uint32_t) ? 1 : -1];
+
+static uint32_t get_forwarding(stella_object *obj) {
+    uint32_t words;
+    memcpy(&words, (char *) obj + sizeof(int), sizeof words);
+    return words;
+}
+
+static void set_forwarding(stella_object *obj, uint32_t words) {
+    memcpy((char *) obj + sizeof(int), &words, sizeof words);
+}
+
+/** Address of a marked heap object once the heap is compacted to base.
+ */
+static void *compacted_address(void *p, char *base) {
+    return base + (size_t) get_forwarding((stella_object *) p) * sizeof(void *);
+}
+
+static void mark_object(void *p) {
+    if (!is_from_space(p)) {
+        mark_large_object(p);
+        return;
+    }
+
+    stella_object *obj = (stella_object *) p;
+    GC_STATS_FULL(stats.reads++;)
+    if (!(obj->object_header & GC_HEADER_MARKED)) {
+        obj->object_header |= GC_HEADER_MARKED;
+#ifdef STELLA_GC_PROFILE
+        census(obj);
+#endif
+        push_gray(p);
+    }
+}
+
+static void update_fields(stella_object *obj, char *base) {
+    size_t field_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+    for (size_t i = 0; i < field_count; i++) {
+        GC_STATS_FULL(stats.reads++;)
+        if (is_from_space(STELLA_OBJECT_FIELD(obj, i))) {
+            GC_STATS_FULL(stats.writes++;)
+            STELLA_OBJECT_SET_FIELD(obj, i, compacted_address(STELLA_OBJECT_FIELD(obj, i), base));
+        }
+    }
+}
+
+/** Collect the heap by marking and compacting it, so that headroom more bytes can be allocated.
+ * The heap grows (into a new region) when the live data and headroom do not fit
+ * and shrinks by lowering limit, following the same target as the copying backends.
+ */
+static void compact(size_t headroom) {
+    account_allocation();
+    current_state.cycle_start_ns = trace_begin();
+    GC_PROBE1(cycle__start, current_state.from_space_size);
+    GC_PROBE(roots__start);
+    GC_STATS_CYCLE(uint64_t start = now_ns();)
+    for (size_t i = 0; i < current_state.roots_size; i++) {
+        mark_object(*current_state.roots[i]);
+    }
+    trace_end(GC_TRACE_ROOTS, current_state.cycle_start_ns, current_state.roots_size, 0);
+    GC_PROBE1(roots__done, current_state.roots_size);
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    uint64_t roots_end = now_ns();
+    stats.root_forwarding_ns += roots_end - start;
+#endif
+    while (current_state.gray_size) {
+        stella_object *obj = (stella_object *) current_state.gray_objects[--current_state.gray_size];
+        size_t field_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+        for (size_t i = 0; i < field_count; i++) {
+            mark_object(STELLA_OBJECT_FIELD(obj, i));
+        }
+    }
+
+    char *heap = (char *) current_state.from_space;
+    char *end = (char *) current_state.next;
+    size_t live = 0;
+    for (char *p = heap; p < end; p += GC_HEAP_OBJ_SIZE((stella_object *) p)) {
+        stella_object *obj = (stella_object *) p;
+        if (obj->object_header & GC_HEADER_MARKED) {
+            set_forwarding(obj, (uint32_t) (live / sizeof(void *)));
+            live += GC_HEAP_OBJ_SIZE(obj);
+        }
+    }
+
+    if (live + headroom > current_state.heap_max_size) {
+        out_of_memory();
+    }
+    size_t heap_size = MAX(heap_target(live), live + headroom);
+    size_t old_size = (size_t) ((char *) current_state.limit - heap);
+    char *base = heap;
+    if (heap_size > current_state.from_space_size) {
+        base = space_alloc(heap_size);
+        if (!base) {
+            out_of_memory();
+        }
+    }
+
+    for (size_t i = 0; i < current_state.roots_size; i++) {
+        if (is_from_space(*current_state.roots[i])) {
+            *current_state.roots[i] = compacted_address(*current_state.roots[i], base);
+        }
+    }
+    for (char *p = heap; p < end; p += GC_HEAP_OBJ_SIZE((stella_object *) p)) {
+        if (((stella_object *) p)->object_header & GC_HEADER_MARKED) {
+            update_fields((stella_object *) p, base);
+        }
+    }
+    for (size_t i = 0; i < current_state.large_objects_size; i++) {
+        if (current_state.large_objects[i].marked) {
+            update_fields((stella_object *) current_state.large_objects[i].address, base);
+        }
+    }
+
+    for (char *p = heap; p < end;) {
+        stella_object *obj = (stella_object *) p;
+        size_t size = GC_HEAP_OBJ_SIZE(obj);
+        if (obj->object_header & GC_HEADER_MARKED) {
+            stella_object *moved = (stella_object *) compacted_address(obj, base);
+            if ((char *) moved != p) {
+                memmove(moved, obj, size);
+            }
+            moved->object_header &= ~GC_HEADER_MARKED;
+        }
+        p += size;
+    }
+
+    if (base != heap) {
+        space_free(heap, current_state.from_space_size, current_state.page_kind);
+        current_state.from_space = base;
+        current_state.from_space_size = heap_size;
+    } else if (heap_size < old_size) {
+        // shrinking in place: the part above the new limit is not used until the heap grows again
+        space_release(base + heap_size, old_size - heap_size);
+    }
+    current_state.next = base + live;
+    current_state.limit = base + heap_size;
+    current_state.heap_target_size = heap_size;
+    current_state.alloc_mark = current_state.next;
+    if (heap_size != old_size) {
+        trace_end(GC_TRACE_RESIZE, trace_begin(), old_size, heap_size);
+        GC_PROBE2(heap__resize, old_size, heap_size);
+    }
+    trace_end(GC_TRACE_CYCLE, current_state.cycle_start_ns, live, heap_size);
+    GC_PROBE2(cycle__done, live, heap_size);
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    if (heap_size > old_size) {
+        stats.heap_grows++;
+    } else if (heap_size < old_size) {
+        stats.heap_shrinks++;
+    }
+    stats.heap_size = heap_size;
+    stats.peak_heap_size = MAX(stats.peak_heap_size, heap_size);
+    stats.scan_ns += now_ns() - roots_end;
+#endif
+    end_cycle_stats();
+    sweep_large_objects();
+}
+
+#endif
+
+#if !defined(STELLA_GC_GENERATIONAL) && !defined(STELLA_GC_MULTI_MUTATOR)
+
+/** Allocate at next outside of a cycle. If from-space is exhausted even after a cycle,
+ * collect once more into a to-space which is large enough (this is how the heap grows).
+ * The stop-the-world backends allocate only here.
+ */
+static void *bump_alloc(size_t size_in_bytes) {
+    if ((char *) current_state.next + size_in_bytes > (char *) current_state.limit) {
+#ifdef STELLA_GC_BACKEND_COMPACT
+        compact(size_in_bytes);
+#else
+        collect_garbage(size_in_bytes);
+        finish_collection();
+#endif
+        if ((char *) current_state.next + size_in_bytes > (char *) current_state.limit) {
+            out_of_memory();
+        }
+    }
+
+    void *ptr = current_state.next;
+    current_state.next = (char *) current_state.next + size_in_bytes;
+#ifdef STELLA_GC_CONSERVATIVE
+    note_object_start(current_state.from_space_starts, current_state.from_space, ptr, size_in_bytes);
+#endif
+    ((stella_object *) ptr)->object_header = 0;
+    return ptr;
+}
+
+#endif
+
+
+#if defined(STELLA_GC_BACKEND_INCREMENTAL) && !defined(STELLA_GC_GENERATIONAL)
+
+/** Upper bound of the from-space bytes which are still to be copied in this cycle.
+ */
+static size_t pending_evacuation() {
+    size_t copied = (char *) current_state.next - (char *) current_state.to_space;
+    return current_state.evacuation_reserve > copied ? current_state.evacuation_reserve - copied : 0;
+}
+
+/** One incremental step before allocating size_in_bytes bytes.
+ *
+ * The step always does the work needed to finish the cycle before limit meets next:
+ * the remaining work (unscanned plus not yet copied bytes) divided by what the mutator
+ * can still allocate. On top of that it tries to scan work_ratio bytes per allocated byte,
+ * but stops early once the step_budget_us time budget (if any) is spent.
+ */
+static void scan_paced(size_t size_in_bytes) {
+    GC_PROBE1(step__start, size_in_bytes);
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_FULL || defined(STELLA_GC_TRACE)
+    uint64_t start = now_ns();
+#else
+    // cheap statistics do not time the steps, which run on the mutator's allocation path
+    uint64_t start = current_state.step_budget_us ? now_ns() : 0;
+#endif
+    uint64_t budget_ns = (uint64_t) current_state.step_budget_us * 1000;
+    size_t pending = pending_evacuation();
+    size_t free_bytes = (char *) current_state.limit - (char *) current_state.next;
+    size_t allocatable = free_bytes > pending ? free_bytes - pending : 0;
+    size_t work = (size_t) ((char *) current_state.next - (char *) current_state.scan) + pending;
+    double required = allocatable ? (double) work / (double) allocatable : (double) work;
+    size_t mandatory = (size_t) (required * (double) size_in_bytes) + 1;
+    size_t target = MAX(mandatory, (size_t) (current_state.work_ratio * (double) size_in_bytes));
+
+    size_t scanned = scan(mandatory);
+    if (!current_state.step_budget_us) {
+        scanned += scan(target - MIN(target, scanned));
+    } else {
+        while (scanned < target && scan_pending()
+               && now_ns() - start < budget_ns) {
+            scanned += scan(MIN(target - scanned, GC_PACING_CHUNK));
+        }
+    }
+    trace_end(GC_TRACE_STEP, start, scanned, size_in_bytes);
+    GC_PROBE1(step__done, scanned);
+
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    stats.incremental_steps++;
+    stats.incremental_scanned_bytes += scanned;
+#endif
+    GC_STATS_FULL(stats.scan_ns += now_ns() - start;)
+}
+
+/** Allocate during an incremental cycle: do one paced scan step, then allocate at limit.
+ */
+void *scan_and_alloc(size_t size_in_bytes) {
+    scan_paced(size_in_bytes);
+
+    if (scan_pending()) {
+        // objects allocated at limit must leave room for the rest of from-space to be copied
+        size_t free_bytes = (char *) current_state.limit - (char *) current_state.next;
+        if (free_bytes < pending_evacuation() + size_in_bytes) {
+            finish_collection();
+            return bump_alloc(size_in_bytes);
+        }
+    } else {
+        flip();
+        return bump_alloc(size_in_bytes);
+    }
+
+    current_state.limit = (char *) current_state.limit - size_in_bytes;
+    ((stella_object *) current_state.limit)->object_header = 0;
+    return current_state.limit;
+}
+
+#endif
+
+
+#ifdef STELLA_GC_GENERATIONAL
+
+/** Record an old generation object which may point into the nursery.
+ */
+static void remember(void *p) {
+    stella_object *obj = (stella_object *) p;
+    if (obj->object_header & GC_HEADER_REMEMBERED) {
+        return;
+    }
+
+    if (current_state.remembered_size == current_state.remembered_capacity) {
+        size_t capacity = MAX(REMEMBERED_SET_INITIAL_CAPACITY, 2 * current_state.remembered_capacity);
+        current_state.remembered_set = realloc(current_state.remembered_set, capacity * sizeof(void *));
+        current_state.remembered_capacity = capacity;
+    }
+    obj->object_header |= GC_HEADER_REMEMBERED;
+    current_state.remembered_set[current_state.remembered_size++] = p;
+}
+
+/** Copy a nursery object to the old generation (at next) unless it was already promoted.
+ * Returns the address of the old generation copy.
+ */
+static void *promote(void *p) {
+    stella_object *obj = (stella_object *) p;
+    GC_STATS_FULL(stats.reads++;)
+    if (obj->object_header & GC_HEADER_FORWARDED) {
+        return STELLA_OBJECT_FIELD(obj, 0);
+    }
+    GC_STATS_FULL(stats.promoted++;)
+    return copy(p);
+}
+
+/** Collect both generations at once: every live object (including the nursery survivors)
+ * is evacuated to to-space, so the remembered set can be dropped.
+ */
+static void collect_major(size_t headroom) {
+    size_t nursery_used = (char *) current_state.nursery_next - (char *) current_state.nursery;
+    // large objects are not copied, so they would keep their remembered bit
+    for (size_t i = 0; i < current_state.remembered_size; i++) {
+        ((stella_object *) current_state.remembered_set[i])->object_header &= ~GC_HEADER_REMEMBERED;
+    }
+    current_state.remembered_size = 0;
+    collect_garbage(nursery_used + headroom);
+    finish_collection();
+    current_state.nursery_next = current_state.nursery;
+    current_state.alloc_mark = current_state.nursery;
+    current_state.tenured_start = current_state.next;
+    current_state.tenured_large_size = 0;
+}
+
+/** Promote the nursery survivors reachable from the roots, the remembered set and the objects
+ * allocated directly in the old generation since the last minor collection (whose fields were
+ * initialized without a barrier). Promoted objects are scanned Cheney-style right behind the latter,
+ * up to the old generation's next, so no old-to-young pointers are left afterwards.
+ */
+static void collect_minor() {
+    account_allocation();
+    uint64_t traced = trace_begin();
+    GC_PROBE(minor__start);
+    char *promoted_start = (char *) current_state.next, *promoted = current_state.tenured_start;
+    size_t roots = current_state.roots_size + current_state.remembered_size + current_state.tenured_large_size;
+    GC_PROBE(roots__start);
+    GC_STATS_CYCLE(uint64_t start = now_ns();)
+
+    for (size_t i = 0; i < current_state.roots_size; i++) {
+        if (is_nursery(*current_state.roots[i])) {
+            *current_state.roots[i] = promote(*current_state.roots[i]);
+        }
+    }
+
+    for (size_t i = 0; i < current_state.remembered_size; i++) {
+        stella_object *obj = (stella_object *) current_state.remembered_set[i];
+        size_t field_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+        for (size_t j = 0; j < field_count; j++) {
+            GC_STATS_FULL(stats.reads++;)
+            if (is_nursery(STELLA_OBJECT_FIELD(obj, j))) {
+                GC_STATS_FULL(stats.writes++;)
+                STELLA_OBJECT_SET_FIELD(obj, j, promote(STELLA_OBJECT_FIELD(obj, j)));
+            }
+        }
+        obj->object_header &= ~GC_HEADER_REMEMBERED;
+    }
+    current_state.remembered_size = 0;
+
+    for (size_t i = 0; i < current_state.tenured_large_size; i++) {
+        stella_object *obj = (stella_object *) current_state.tenured_large[i];
+        size_t field_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+        for (size_t j = 0; j < field_count; j++) {
+            GC_STATS_FULL(stats.reads++;)
+            if (is_nursery(STELLA_OBJECT_FIELD(obj, j))) {
+                GC_STATS_FULL(stats.writes++;)
+                STELLA_OBJECT_SET_FIELD(obj, j, promote(STELLA_OBJECT_FIELD(obj, j)));
+            }
+        }
+    }
+    current_state.tenured_large_size = 0;
+    trace_end(GC_TRACE_ROOTS, traced, roots, 0);
+    GC_PROBE1(roots__done, roots);
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    uint64_t roots_end = now_ns();
+    stats.root_forwarding_ns += roots_end - start;
+#endif
+
+    while (promoted < (char *) current_state.next) {
+        stella_object *obj = (stella_object *) promoted;
+        size_t field_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+        for (size_t i = 0; i < field_count; i++) {
+            GC_STATS_FULL(stats.reads++;)
+            if (is_nursery(STELLA_OBJECT_FIELD(obj, i))) {
+                GC_STATS_FULL(stats.writes++;)
+                STELLA_OBJECT_SET_FIELD(obj, i, promote(STELLA_OBJECT_FIELD(obj, i)));
+            }
+        }
+        promoted += GC_HEAP_OBJ_SIZE(obj);
+    }
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    stats.scan_ns += now_ns() - roots_end;
+    stats.promoted_bytes += (char *) current_state.next - promoted_start;
+    stats.gc_cycles++;
+    stats.minor_gc_cycles++;
+#endif
+#ifdef STELLA_GC_PROFILE
+    profile_sample("minor");
+#endif
+    trace_end(GC_TRACE_MINOR, traced, (char *) current_state.next - promoted_start, 0);
+    GC_PROBE1(minor__done, (char *) current_state.next - promoted_start);
+
+    current_state.nursery_next = current_state.nursery;
+    current_state.alloc_mark = current_state.nursery;
+    current_state.tenured_start = current_state.next;
+}
+
+/** Empty the nursery. Falls back to a major collection when the old generation
+ * cannot take every nursery object in the worst case.
+ */
+static void collect_nursery() {
+    size_t used = (char *) current_state.nursery_next - (char *) current_state.nursery;
+    if ((size_t) ((char *) current_state.limit - (char *) current_state.next) < used) {
+        pause_begin(GC_PAUSE_FULL);
+        collect_major(0);
+    } else {
+        pause_begin(GC_PAUSE_MINOR);
+        collect_minor();
+    }
+    pause_end();
+}
+
+/** Allocate directly in the old generation (objects that do not fit into the nursery).
+ * Its fields are initialized without a write barrier: the next minor collection scans it
+ * (from tenured_start) instead of remembering it.
+ */
+static void *alloc_old(size_t size_in_bytes) {
+    if ((char *) current_state.next + size_in_bytes > (char *) current_state.limit) {
+        pause_begin(GC_PAUSE_FULL);
+        collect_major(size_in_bytes);
+        pause_end();
+        if ((char *) current_state.next + size_in_bytes > (char *) current_state.limit) {
+            out_of_memory();
+        }
+    }
+
+    void *ptr = current_state.next;
+    current_state.next = (char *) current_state.next + size_in_bytes;
+    ((stella_object *) ptr)->object_header = 0;
+#if STELLA_GC_STATS_LEVEL == STELLA_GC_STATS_CHEAP
+    stats.total_allocated_bytes += size_in_bytes;
+#endif
+    return ptr;
+}
+
+static void *alloc_young(size_t size_in_bytes) {
+    if (size_in_bytes > current_state.nursery_size) {
+        return alloc_old(size_in_bytes);
+    }
+
+    if ((char *) current_state.nursery_next + size_in_bytes > (char *) current_state.nursery_limit) {
+        collect_nursery();
+    }
+
+    void *ptr = current_state.nursery_next;
+    current_state.nursery_next = (char *) current_state.nursery_next + size_in_bytes;
+    ((stella_object *) ptr)->object_header = 0;
+    return ptr;
+}
+
+#endif
+
+#ifdef STELLA_GC_MULTI_MUTATOR
+
+/* Several mutator threads share the heap. Each one allocates from its own buffer (TLAB)
+ * claimed from from-space and has its own stack of roots. Claiming a buffer, allocating a large object
+ * and collecting happen under mutators.lock. A thread that has to collect requests a stop and waits
+ * until every other mutator is stopped: parked at a safepoint (any allocation, which polls the stop
+ * request on its fast path, or gc_safepoint) or between gc_blocking_begin and gc_blocking_end. It then collects with the roots
+ * of all mutators and resets their buffers.
+ */
+
+typedef struct Gc_mutator {
+    gc_root *roots;
+    size_t roots_size, roots_capacity;
+    char *tlab_next, *tlab_limit;
+    struct Gc_mutator *next_mutator;
+} gc_mutator;
+
+static __thread gc_mutator *this_mutator = NULL;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t stopped_cond, resumed;
+    pthread_key_t key;              /**< Unregisters a mutator when its thread exits. */
+    gc_mutator *list;
+    size_t registered;
+    size_t stopped;                 /**< Mutators parked at a safepoint or blocked. */
+} mutators = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .stopped_cond = PTHREAD_COND_INITIALIZER,
+        .resumed = PTHREAD_COND_INITIALIZER,
+        .list = NULL,
+        .registered = 0,
+        .stopped = 0,
+};
+
+/** Wait while another thread collects. Called with mutators.lock held.
+ */
+static void park() {
+    if (!current_state.stop_requested) {
+        return;
+    }
+    mutators.stopped++;
+    pthread_cond_signal(&mutators.stopped_cond);
+    while (current_state.stop_requested) {
+        pthread_cond_wait(&mutators.resumed, &mutators.lock);
+    }
+    mutators.stopped--;
+}
+
+/** Stop the other mutators and collect with the roots of all of them,
+ * so that headroom more bytes can be allocated. Called with mutators.lock held.
+ */
+static void collect_stopped(size_t headroom) {
+    __atomic_store_n(&current_state.stop_requested, true, __ATOMIC_RELAXED);
+    while (mutators.stopped + 1 < mutators.registered) {
+        pthread_cond_wait(&mutators.stopped_cond, &mutators.lock);
+    }
+
+    current_state.roots_size = 0;
+    for (gc_mutator *mutator = mutators.list; mutator; mutator = mutator->next_mutator) {
+        size_t size = current_state.roots_size + mutator->roots_size;
+        if (size > current_state.roots_capacity) {
+            size_t capacity = MAX(size, 2 * current_state.roots_capacity);
+            current_state.roots = realloc(current_state.roots, capacity * sizeof(gc_root));
+            current_state.roots_capacity = capacity;
+        }
+        if (mutator->roots_size) {
+            memcpy(&current_state.roots[current_state.roots_size], mutator->roots, mutator->roots_size * sizeof(gc_root));
+        }
+        current_state.roots_size = size;
+        mutator->tlab_next = mutator->tlab_limit = NULL;
+    }
+    collect_garbage(headroom);
+    finish_collection();
+
+    __atomic_store_n(&current_state.stop_requested, false, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&mutators.resumed);
+}
+
+/** Slow path of the allocation: claim a new buffer from from-space (or only the object itself
+ * if it is big), collecting first when from-space is exhausted.
+ */
+static void *tlab_alloc_slow(size_t size_in_bytes) {
+    gc_mutator *self = this_mutator;
+    pthread_mutex_lock(&mutators.lock);
+    park();
+    if ((char *) current_state.next + size_in_bytes > (char *) current_state.limit) {
+        pause_begin(GC_PAUSE_FULL);
+        collect_stopped(0);
+        if ((char *) current_state.next + size_in_bytes > (char *) current_state.limit) {
+            // collect once more into a to-space which is large enough (this is how the heap grows)
+            collect_stopped(size_in_bytes);
+        }
+        pause_end();
+        if ((char *) current_state.next + size_in_bytes > (char *) current_state.limit) {
+            out_of_memory();
+        }
+    }
+
+    char *ptr = (char *) current_state.next;
+    size_t claimed = size_in_bytes;
+    if (size_in_bytes <= GC_TLAB_SIZE / 4) {
+        claimed = MIN(GC_TLAB_SIZE, (size_t) ((char *) current_state.limit - ptr));
+        self->tlab_next = ptr + size_in_bytes;
+        self->tlab_limit = ptr + claimed;
+    }
+    current_state.next = ptr + claimed;
+    pthread_mutex_unlock(&mutators.lock);
+    return ptr;
+}
+
+#endif
+
+/** Allocate a large object outside of the semispaces. Once the large objects allocated
+ * since the last flip outgrow a semispace, a complete collection frees the unreachable ones first.
+ * Objects allocated during an incremental cycle are marked, so they survive it.
+ */
+static void *alloc_large(size_t size_in_bytes) {
+#ifdef STELLA_GC_MULTI_MUTATOR
+    pthread_mutex_lock(&mutators.lock);
+    park();
+#endif
+    if (current_state.large_allocated_since_flip + size_in_bytes > current_state.from_space_size) {
+        pause_begin(GC_PAUSE_FULL);
+#ifdef STELLA_GC_GENERATIONAL
+        collect_major(0);
+#elif defined(STELLA_GC_MULTI_MUTATOR)
+        collect_stopped(0);
+#elif defined(STELLA_GC_BACKEND_COMPACT)
+        compact(0);
+#else
+        if (!current_state.gc_running) {
+            collect_garbage(0);
+        }
+        finish_collection();
+#endif
+        pause_end();
+    }
+    void *ptr = NULL;
+    if (current_state.large_objects_bytes + size_in_bytes <= current_state.heap_max_size) {
+#ifdef STELLA_COMPRESSED_REFS
+        ptr = reservation_alloc(size_in_bytes);
+#else
+        ptr = malloc(size_in_bytes);
+#endif
+    }
+    if (!ptr) {
+        out_of_memory();
+    }
+
+    if (current_state.large_objects_size == current_state.large_objects_capacity) {
+        size_t capacity = MAX(LARGE_OBJECTS_INITIAL_CAPACITY, 2 * current_state.large_objects_capacity);
+        current_state.large_objects = realloc(current_state.large_objects, capacity * sizeof(gc_large_object));
+        current_state.large_objects_capacity = capacity;
+    }
+    size_t i = large_object_index(ptr);
+    memmove(&current_state.large_objects[i + 1], &current_state.large_objects[i],
+            (current_state.large_objects_size - i) * sizeof(gc_large_object));
+    current_state.large_objects[i].address = ptr;
+    current_state.large_objects[i].size = size_in_bytes;
+    current_state.large_objects[i].marked = current_state.gc_running;
+    current_state.large_objects_size++;
+    current_state.large_objects_bytes += size_in_bytes;
+    current_state.large_allocated_since_flip += size_in_bytes;
+    GC_STATS_CYCLE(stats.large_objects_allocated++;)
+#if STELLA_GC_STATS_LEVEL == STELLA_GC_STATS_CHEAP
+    stats.total_allocated_bytes += size_in_bytes;
+#endif
+
+    ((stella_object *) ptr)->object_header = 0;
+#ifdef STELLA_GC_GENERATIONAL
+    // its fields are initialized without a write barrier: the next minor collection scans it
+    if (current_state.tenured_large_size == current_state.tenured_large_capacity) {
+        size_t capacity = MAX(REMEMBERED_SET_INITIAL_CAPACITY, 2 * current_state.tenured_large_capacity);
+        current_state.tenured_large = realloc(current_state.tenured_large, capacity * sizeof(void *));
+        current_state.tenured_large_capacity = capacity;
+    }
+    current_state.tenured_large[current_state.tenured_large_size++] = ptr;
+#endif
+#ifdef STELLA_GC_MULTI_MUTATOR
+    pthread_mutex_unlock(&mutators.lock);
+#endif
+    return ptr;
+}
+
+static size_t env_size(const char *name, size_t default_size) {
+    const char *value = getenv(name);
+    if (!value || !*value) {
+        return default_size;
+    }
+
+    char *suffix;
+    size_t size = (size_t) strtoull(value, &suffix, 10);
+    switch (*suffix) {
+        case 'g':
+        case 'G':
+            size *= 1024;
+            // fallthrough
+        case 'm':
+        case 'M':
+            size *= 1024;
+            // fallthrough
+        case 'k':
+        case 'K':
+            size *= 1024;
+            break;
+        default:
+            break;
+    }
+    return size ? size : default_size;
+}
+
+static const char *release_names[] = {"none", "lazy", "eager"};
+static const char *page_names[] = {"off", "thp", "hugetlb"};
+static const char *copy_order_names[] = {"breadth", "chase", "depth"};
+
+/** Index of the value of an environment variable among names, or default_choice if it is unset or unknown.
+ */
+static int env_choice(const char *name, const char *names[], int count, int default_choice) {
+    const char *value = getenv(name);
+    for (int i = 0; value && i < count; i++) {
+        if (!strcmp(value, names[i])) {
+            return i;
+        }
+    }
+    return default_choice;
+}
+
+static void write_stats_json() {
+    FILE *out = fopen(stats_json_path, "w");
+    if (!out) {
+        perror(stats_json_path);
+        return;
+    }
+#ifdef STELLA_GC_CONTEXTS
+    gc_context *bound = gc_context_bind(&gc_default_context);
+    print_gc_stats_json(out);
+    gc_context_bind(bound);
+#else
+    print_gc_stats_json(out);
+#endif
+    fclose(out);
+}
+
+#ifdef STELLA_GC_TRACE
+
+static void write_trace() {
+    FILE *out = fopen(trace_path, "w");
+    if (!out) {
+        perror(trace_path);
+        return;
+    }
+    print_gc_trace_json(out);
+    fclose(out);
+}
+
+/** Allocate the ring buffer, unless another heap did. The first one to do so writes the trace at exit.
+ */
+static void trace_open() {
+    if (__atomic_load_n(&trace.events, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    size_t capacity = env_size("STELLA_GC_TRACE_EVENTS", GC_TRACE_EVENTS);
+    gc_trace_event *events = calloc(capacity, sizeof(gc_trace_event));
+    if (!events) {
+        return;
+    }
+    gc_trace_event *expected = NULL;
+    trace.capacity = capacity;
+    if (!__atomic_compare_exchange_n(&trace.events, &expected, events, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        free(events);
+        return;
+    }
+    trace_path = getenv("STELLA_GC_TRACE_FILE");
+    if (!trace_path) {
+        trace_path = GC_TRACE_FILE;
+    }
+    if (*trace_path) {
+        atexit(write_trace);
+    }
+}
+
+#endif
+
+/** Read the heap configuration and allocate the initial spaces.
+ */
+static void gc_init() {
+    GC_STATS_CYCLE(stats.start_ns = now_ns();)
+#ifdef STELLA_GC_PROFILE
+    GC_CONTEXT->profile.start_ns = now_ns();
+#endif
+#ifdef STELLA_GC_TRACE
+    trace_open();
+#endif
+    if (GC_CONTEXT == &gc_default_context) {
+        // only the default heap reports at exit
+        stats_json_path = getenv("STELLA_GC_STATS_JSON");
+        if (stats_json_path && *stats_json_path) {
+            atexit(write_stats_json);
+        }
+#ifdef STELLA_GC_PROFILE
+        const char *profile_path = getenv("STELLA_GC_PROFILE_FILE");
+        if (!profile_path) {
+            profile_path = GC_PROFILE_FILE;
+        }
+        if (*profile_path) {
+            profile_open(profile_path);
+        }
+#endif
+    }
+    size_t initial_size = env_size("STELLA_GC_INITIAL_HEAP", FROM_SPACE_SIZE);
+    current_state.heap_initial_size = initial_size;
+    current_state.heap_max_size = MAX(env_size("STELLA_GC_MAX_HEAP", MAX_HEAP_SIZE), initial_size);
+    const char *occupancy = getenv("STELLA_GC_OCCUPANCY");
+    if (occupancy && strtod(occupancy, NULL) > 1.0) {
+        current_state.heap_occupancy = strtod(occupancy, NULL);
+    }
+    current_state.heap_target_size = initial_size;
+    const char *work_ratio = getenv("STELLA_GC_WORK_RATIO");
+    if (work_ratio && strtod(work_ratio, NULL) > 0.0) {
+        current_state.work_ratio = strtod(work_ratio, NULL);
+    }
+    const char *step_budget = getenv("STELLA_GC_STEP_BUDGET_US");
+    if (step_budget) {
+        current_state.step_budget_us = strtoul(step_budget, NULL, 10);
+    }
+
+    current_state.release_policy = env_choice("STELLA_GC_RELEASE", release_names, 3, current_state.release_policy);
+    current_state.page_kind = env_choice("STELLA_GC_HUGE_PAGES", page_names, 3, current_state.page_kind);
+    current_state.copy_order = env_choice("STELLA_GC_COPY_ORDER", copy_order_names, 3, current_state.copy_order);
+    const char *prefetch = getenv("STELLA_GC_PREFETCH");
+    if (prefetch && *prefetch) {
+        current_state.prefetch_distance = strtoul(prefetch, NULL, 10);
+    }
 
-bool is_record(void *p){
-    if (!p) return false;
-    stella_object *obj = (stella_object *) p;
-    enum TAG tag = STELLA_OBJECT_HEADER_TAG(obj->object_header);
-    size_t size = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
-    switch (tag) {
-        case TAG_ZERO:
-        case TAG_SUCC:
-        case TAG_FALSE:
-        case TAG_TRUE:
-            return false;
-        case TAG_FN:
-        case TAG_REF:
-        case TAG_UNIT:
-            return true;
-        case TAG_TUPLE:
-            return size > 0;
-        case TAG_INL:
-        case TAG_INR:
-        case TAG_EMPTY:
-        case TAG_CONS:
-            return true;
-        default:
-            return false;
+#ifdef STELLA_COMPRESSED_REFS
+    reserve_heap();
+#endif
+    void *from_space = space_alloc(initial_size);
+    if (!from_space) {
+        out_of_memory();
+    }
+    current_state.from_space = from_space;
+    current_state.from_space_size = initial_size;
+    current_state.next = from_space;
+    current_state.limit = (char *) from_space + initial_size;
+    current_state.alloc_mark = from_space;
+    GC_STATS_CYCLE(stats.heap_size = initial_size; stats.peak_heap_size = initial_size;)
+#ifdef STELLA_GC_CONSERVATIVE
+    current_state.stack_base = native_stack_base();
+    while (((size_t) 1 << current_state.page_shift) < space_unit(current_state.page_kind)) {
+        current_state.page_shift++;
     }
+    current_state.from_space_starts = resize_object_starts(NULL, initial_size);
+#endif
+#ifdef STELLA_GC_GENERATIONAL
+    size_t nursery_size = NURSERY_SIZE;
+    void *nursery = space_alloc(nursery_size);
+    current_state.nursery = nursery;
+    current_state.nursery_size = nursery_size;
+    current_state.nursery_next = nursery;
+    current_state.nursery_limit = (char *) nursery + nursery_size;
+    current_state.alloc_mark = nursery;
+    current_state.tenured_start = current_state.next;
+#endif
+#ifdef STELLA_GC_PARALLEL
+    pthread_once(&pool.once, start_workers);
+    stats.gc_workers = pool.size;
+#endif
 }
 
+#ifdef STELLA_GC_CONTEXTS
 
-void *get_first_field(void *p) {
-    stats.reads++;
-    stella_object *obj = (stella_object *) p;
-    size_t fields_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
-    if (fields_count <= 0) {
+gc_context *gc_context_create() {
+    static const gc_context template = GC_CONTEXT_TEMPLATE;
+    gc_context *context = malloc(sizeof(gc_context));
+    if (!context) {
         return NULL;
     }
-
-    return obj->object_fields[0];
+    *context = template;
+    return context;
 }
 
-
-void set_first_field(void *p, void *data) {
-    stats.writes++;
-    stella_object *obj = (stella_object *) p;
-    size_t fields_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
-    if (fields_count <= 0) {
+void gc_context_destroy(gc_context *context) {
+    if (!context || context == &gc_default_context) {
         return;
     }
-
-    obj->object_fields[0] = data;
+    if (gc_bound_context == context) {
+        gc_bound_context = &gc_default_context;
+    }
+    gc_state *state = &context->state;
+    space_free(state->from_space, state->from_space_size, state->page_kind);
+    space_free(state->to_space, state->to_space_size, state->page_kind);
+    space_free(state->nursery, state->nursery_size, state->page_kind);
+    free(state->roots);
+    free(state->remembered_set);
+    free(state->tenured_large);
+    free(state->gray_objects);
+    for (size_t i = 0; i < state->large_objects_size; i++) {
+        free(state->large_objects[i].address);
+    }
+    free(state->large_objects);
+    for (size_t i = 0; i < state->snapshots_size; i++) {
+        munmap(state->snapshots[i].address, state->snapshots[i].size);
+    }
+    free(state->snapshots);
+    free(context);
 }
 
-
-void chase(void *p) {
-    do {
-        stella_object *obj = (stella_object *) p;
-        size_t fields_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
-        void *q = current_state.next;
-        size_t q_size = GC_OBJ_SIZE(obj);
-        current_state.next = (char *) q + q_size;
-        void *r = NULL;
-        stats.reads++;
-        stats.writes++;
-        memcpy(q, p, q_size);
-        for (size_t i = 0; i < fields_count; i++) {
-            stella_object *qf1 = (stella_object *) obj->object_fields[i];
-            stats.reads++;
-
-            if (is_record(qf1) && is_from_space(qf1)) {
-                void *qff1 = get_first_field(qf1);
-                if (!is_record(qff1) || !is_to_space(qff1)) {
-                    r = qf1;
-                }
-
-            }
-        }
-        set_first_field(p, q);
-        p = r;
-    } while (p != NULL);
+gc_context *gc_context_bind(gc_context *context) {
+    gc_context *bound = gc_bound_context;
+    gc_bound_context = context ? context : &gc_default_context;
+    return bound;
 }
 
-void *forward(void *p) {
-    if (is_record(p) && is_from_space(p)) {
-        void *f1 = get_first_field(p);
+#endif
 
-        if (!f1) {
-            return p;
-        }
+#ifdef STELLA_GC_MULTI_MUTATOR
 
-        if (is_record(f1) && is_to_space(f1)) {
-            return f1;
-        } else {
-            chase(p);
-            return get_first_field(p);
-        }
-    } else {
-        return p;
+static void unregister_mutator(void *mutator) {
+    gc_mutator *self = (gc_mutator *) mutator;
+    pthread_mutex_lock(&mutators.lock);
+    park();
+    gc_mutator **link = &mutators.list;
+    while (*link != self) {
+        link = &(*link)->next_mutator;
     }
+    *link = self->next_mutator;
+    mutators.registered--;
+    pthread_cond_signal(&mutators.stopped_cond);
+    pthread_mutex_unlock(&mutators.lock);
+    free(self->roots);
+    free(self);
 }
 
+void gc_register_thread() {
+    if (this_mutator) {
+        return;
+    }
+    gc_mutator *self = calloc(1, sizeof(gc_mutator));
+    pthread_mutex_lock(&mutators.lock);
+    if (!current_state.from_space) {
+        gc_init();
+        pthread_key_create(&mutators.key, unregister_mutator);
+    }
+    if (!self) {
+        out_of_memory();
+    }
+    self->next_mutator = mutators.list;
+    mutators.list = self;
+    mutators.registered++;
+    park();
+    pthread_mutex_unlock(&mutators.lock);
+    pthread_setspecific(mutators.key, self);
+    this_mutator = self;
+}
 
-void collect_garbage() {
-    current_state.gc_running = true;
-    if (!current_state.to_space) {
-        size_t to_space_size = TO_SPACE_SIZE;
-        void *to_space = malloc(to_space_size);
-        current_state.to_space = to_space;
-        current_state.to_space_size = to_space_size;
-        current_state.next = to_space;
-        current_state.scan = to_space;
-        current_state.limit = to_space + to_space_size;
+void gc_unregister_thread() {
+    if (!this_mutator) {
+        return;
     }
+    pthread_setspecific(mutators.key, NULL);
+    unregister_mutator(this_mutator);
+    this_mutator = NULL;
+}
 
+void gc_blocking_begin() {
+    if (!this_mutator) {
+        return;
+    }
+    pthread_mutex_lock(&mutators.lock);
+    mutators.stopped++;
+    pthread_cond_signal(&mutators.stopped_cond);
+    pthread_mutex_unlock(&mutators.lock);
+}
 
-    for (gc_root *node = current_state.roots_list; node != NULL; node = node->next) {
-        *node->content = forward(*node->content);
+void gc_blocking_end() {
+    if (!this_mutator) {
+        return;
+    }
+    pthread_mutex_lock(&mutators.lock);
+    while (current_state.stop_requested) {
+        pthread_cond_wait(&mutators.resumed, &mutators.lock);
     }
+    mutators.stopped--;
+    pthread_mutex_unlock(&mutators.lock);
 }
 
+void gc_safepoint_slow() {
+    pthread_mutex_lock(&mutators.lock);
+    park();
+    pthread_mutex_unlock(&mutators.lock);
+}
 
-void *scan_and_alloc(size_t size_in_bytes) {
-    size_t scanned = 0;
-    while (scanned < size_in_bytes) {
-        stats.reads++;
-        stella_object *obj = (stella_object *) current_state.scan;
-        size_t field_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
-        size_t obj_size = GC_OBJ_SIZE(obj);
-        for (size_t i = 0; i < field_count; i++) {
-            void *field = obj->object_fields[i];
-            stats.reads++;
-            if (is_from_space(field)) {
-                stats.writes++;
-                obj->object_fields[i] = forward(field);
-            }
-        }
-        scanned += obj_size;
-        current_state.scan += obj_size;
+static gc_mutator *current_mutator() {
+    if (GC_UNLIKELY(!this_mutator)) {
+        gc_register_thread();
     }
+    return this_mutator;
+}
 
-    if (current_state.limit - size_in_bytes < current_state.next) {
-        fprintf(stderr, "Out of memory\n");
-        print_gc_alloc_stats();
-        print_gc_roots();
-        print_gc_state();
-        exit(-1);
-    }
+/** The roots of the calling thread (current_state.roots only gathers them for a collection). */
+#define ROOT_STACK (*current_mutator())
 
-    stats.total_allocated++;
-    stats.total_allocated_bytes += size_in_bytes;
-    stats.residency++;
-    stats.residency_bytes += size_in_bytes;
-    stats.writes++;
+#else
 
-    if (current_state.scan >= current_state.next) {
-        current_state.gc_running = false;
-        void *tmp = current_state.from_space;
-        current_state.from_space = current_state.to_space;
-        current_state.to_space = tmp;
+void gc_register_thread() {}
 
-        size_t size_tmp = current_state.from_space_size;
-        current_state.from_space_size = current_state.to_space_size;
-        current_state.to_space_size = size_tmp;
-        stats.gc_cycles++;
-        stats.maximum_residency = MAX(stats.maximum_residency, stats.residency);
-        stats.maximum_residency_bytes = MAX(stats.maximum_residency_bytes, stats.residency_bytes);
-        stats.residency = 0;
-        stats.residency_bytes = 0;
-    }
+void gc_unregister_thread() {}
 
+void gc_blocking_begin() {}
 
-    current_state.limit -= size_in_bytes;
-    return current_state.limit;
-}
+void gc_blocking_end() {}
+
+#define ROOT_STACK current_state
 
+#endif
 
 void *gc_alloc(size_t size_in_bytes) {
+#ifdef STELLA_GC_MULTI_MUTATOR
+    gc_mutator *self = current_mutator();
+#else
     if (!current_state.from_space) {
-        size_t from_space_size = FROM_SPACE_SIZE;
-        void *from_space = malloc(from_space_size);
-        current_state.from_space = from_space;
-        current_state.from_space_size = from_space_size;
-        current_state.next = from_space;
-        current_state.limit = from_space + from_space_size;
+        gc_init();
     }
+#endif
+    size_in_bytes = MAX(size_in_bytes, GC_MIN_OBJ_SIZE);
 
-    if (current_state.gc_running) {
-        return scan_and_alloc(size_in_bytes);
+    void *ptr;
+    if (size_in_bytes >= LARGE_OBJECT_SIZE) {
+        ptr = alloc_large(size_in_bytes);
     }
-
-    if (current_state.next + size_in_bytes >= current_state.limit) {
-        collect_garbage();
-        return scan_and_alloc(size_in_bytes);
+#ifdef STELLA_GC_GENERATIONAL
+    else {
+        ptr = alloc_young(size_in_bytes);
     }
+#elif defined(STELLA_GC_BACKEND_INCREMENTAL)
+    else if (current_state.gc_running) {
+        // a step per allocation: only full statistics time it, the flip below starts the cycle
+        GC_STATS_FULL(pause_begin(GC_PAUSE_STEP);)
+        ptr = scan_and_alloc(size_in_bytes);
+        GC_STATS_FULL(pause_end();)
+    } else if ((char *) current_state.next + size_in_bytes > (char *) current_state.limit) {
+        pause_begin(GC_PAUSE_STEP);
+        collect_garbage(size_in_bytes);
+        ptr = scan_and_alloc(size_in_bytes);
+        pause_end();
+    } else {
+        ptr = bump_alloc(size_in_bytes);
+    }
+#elif defined(STELLA_GC_MULTI_MUTATOR)
+    else if (GC_UNLIKELY(__atomic_load_n(&current_state.stop_requested, __ATOMIC_RELAXED))) {
+        // every allocation is a safepoint, not only those which refill the buffer: the slow path parks
+        ptr = tlab_alloc_slow(size_in_bytes);
+    } else if ((size_t) (self->tlab_limit - self->tlab_next) >= size_in_bytes) {
+        ptr = self->tlab_next;
+        self->tlab_next += size_in_bytes;
+    } else {
+        ptr = tlab_alloc_slow(size_in_bytes);
+    }
+    ((stella_object *) ptr)->object_header = 0;
+#elif defined(STELLA_GC_BACKEND_CHENEY)
+    else if ((char *) current_state.next + size_in_bytes > (char *) current_state.limit) {
+        pause_begin(GC_PAUSE_FULL);
+        collect_garbage(size_in_bytes);
+        finish_collection();
+        ptr = bump_alloc(size_in_bytes);
+        pause_end();
+    } else {
+        ptr = bump_alloc(size_in_bytes);
+    }
+#else
+    else if ((char *) current_state.next + size_in_bytes > (char *) current_state.limit) {
+        pause_begin(GC_PAUSE_FULL);
+        ptr = bump_alloc(size_in_bytes);
+        pause_end();
+    } else {
+        ptr = bump_alloc(size_in_bytes);
+    }
+#endif
 
-    void *ptr = current_state.next;
-    current_state.next += size_in_bytes;
-
-    stats.total_allocated++;
-    stats.total_allocated_bytes += size_in_bytes;
-    stats.residency++;
-    stats.residency_bytes += size_in_bytes;
-    stats.writes++;
+    GC_STATS_FULL(
+        stats.total_allocated++;
+        stats.total_allocated_bytes += size_in_bytes;
+        stats.residency++;
+        stats.writes++;
+    )
 
     return ptr;
 }
 
+gc_bulk gc_alloc_bulk(size_t count, size_t size_in_bytes) {
+    gc_bulk bulk = { NULL, NULL };
+    if (count == 0 || size_in_bytes > GC_BULK_MAX_SIZE || size_in_bytes / count < GC_MIN_OBJ_SIZE) {
+        // the caller splits the run or allocates the objects one by one
+        return bulk;
+    }
+    bulk.next = gc_alloc(size_in_bytes);
+    bulk.end = bulk.next + size_in_bytes;
+    // gc_alloc counted the run as a single object
+    GC_STATS_FULL(
+        if (count > 1) {
+            stats.total_allocated += count - 1;
+            stats.residency += count - 1;
+        }
+    )
+    return bulk;
+}
+
 void gc_read_barrier(void *object, int field_index) {
-    stats.read_barriers++;
     if(!current_state.gc_running){
         return;
     }
 
     stella_object *obj = (stella_object *) object;
-    void *f = obj->object_fields[field_index];
+    void *f = STELLA_OBJECT_FIELD(obj, field_index);
     if (is_from_space(f)) {
-        obj->object_fields[field_index] = forward(f);
+        STELLA_OBJECT_SET_FIELD(obj, field_index, forward(f));
+    } else {
+        // the mutator may store f anywhere, so a large object it reads must not stay unmarked
+        mark_large_object(f);
     }
 }
 
 
 void gc_write_barrier(void *object, int field_index, void *contents) {
-    stats.write_barriers++;
+#ifdef STELLA_GC_GENERATIONAL
+    if (is_nursery(contents) && !is_nursery(object)) {
+        remember(object);
+    }
+#endif
+}
+
+static void reserve_roots(size_t count) {
+    if (ROOT_STACK.roots_size + count <= ROOT_STACK.roots_capacity) {
+        return;
+    }
+
+    size_t capacity = MAX(ROOT_STACK_INITIAL_CAPACITY, 2 * ROOT_STACK.roots_capacity);
+    capacity = MAX(capacity, ROOT_STACK.roots_size + count);
+    ROOT_STACK.roots = realloc(ROOT_STACK.roots, capacity * sizeof(gc_root));
+    ROOT_STACK.roots_capacity = capacity;
 }
 
 void gc_push_root(void **object) {
@@ -275,52 +3005,386 @@ void gc_push_root(void **object) {
         return;
     }
 
-    gc_root *node = (gc_root *) malloc(sizeof(gc_root));
+    reserve_roots(1);
+    ROOT_STACK.roots[ROOT_STACK.roots_size++] = object;
+}
 
-    node->next = NULL;
-    node->prev = current_state.roots_last;
-    node->content = object;
+void gc_pop_root(void **object) {
+    if (ROOT_STACK.roots_size && ROOT_STACK.roots[ROOT_STACK.roots_size - 1] == object) {
+        ROOT_STACK.roots_size--;
+        return;
+    }
 
-    if (current_state.roots_last) {
-        current_state.roots_last->next = node;
-    } else {
-        current_state.roots_list = node;
+    // not at the top: fall back to removing the innermost matching slot
+    size_t i = ROOT_STACK.roots_size;
+    while (i > 0 && ROOT_STACK.roots[i - 1] != object) {
+        i--;
+    }
+    if (i == 0) {
+        return;
     }
-    current_state.roots_last = node;
-    current_state.roots_size++;
+
+    memmove(&ROOT_STACK.roots[i - 1], &ROOT_STACK.roots[i],
+            (ROOT_STACK.roots_size - i) * sizeof(gc_root));
+    ROOT_STACK.roots_size--;
 }
 
-void gc_pop_root(void **object) {
-    gc_root *node;
-    for (node = current_state.roots_last; node != NULL; node = node->prev) {
-        if (node->content == object) {
-            break;
+size_t gc_push_roots(size_t count, void **objects[]) {
+    size_t frame = ROOT_STACK.roots_size;
+    reserve_roots(count);
+    for (size_t i = 0; i < count; i++) {
+        if (objects[i]) {
+            ROOT_STACK.roots[ROOT_STACK.roots_size++] = objects[i];
+        }
+    }
+    return frame;
+}
+
+void gc_pop_frame(size_t frame) {
+    if (frame < ROOT_STACK.roots_size) {
+        ROOT_STACK.roots_size = frame;
+    }
+}
+
+#ifndef STELLA_COMPRESSED_REFS
+
+/* Heap images. An image is a sequence of 8-byte words: a gc_image_header, the saved objects
+ * (the values of the roots, then the objects reachable from them, laid out like a Cheney to-space)
+ * and a table of relocations. Every word holding a pointer has a relocation: either to an object
+ * of the image (the word holds its offset from the start of the image) or to a static object
+ * or code (the word holds its distance from the_ZERO, as the executable may be loaded elsewhere).
+ * Immediate Nats and NULL are saved as they are.
+ */
+
+#define GC_IMAGE_MAGIC "STELLAHI"
+#define GC_IMAGE_VERSION 1
+#define GC_IMAGE_STATIC 1   /**< Relocation bit: the word is relative to the_ZERO rather than to the image. */
+
+typedef struct Gc_image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t word_size;
+    uint64_t layout;             /**< Distance between the runtime's code and data, identifies the executable. */
+    uint64_t roots_count;        /**< Saved objects, right after the header. */
+    uint64_t words;              /**< Words before the relocations, including the header. */
+    uint64_t relocations_count;  /**< Index of the relocated word, shifted left by one, or GC_IMAGE_STATIC. */
+} gc_image_header;
+
+#define GC_IMAGE_HEADER_WORDS (sizeof(gc_image_header) / sizeof(uint64_t))
+
+typedef struct Gc_image_entry {
+    void *object;
+    size_t offset;
+} gc_image_entry;
+
+typedef struct Gc_image_writer {
+    uint64_t *words;
+    size_t words_size, words_capacity;
+    uint64_t *relocations;
+    size_t relocations_size, relocations_capacity;
+    gc_image_entry *table;       /**< Saved objects by address (open addressing), instead of forwarding them. */
+    size_t table_size, table_capacity;
+    bool failed;
+} gc_image_writer;
+
+static uint64_t image_layout() {
+    return (uint64_t) ((uintptr_t) gc_alloc - (uintptr_t) &the_ZERO);
+}
+
+static size_t find_snapshot(void *p) {
+    for (size_t i = 0; i < current_state.snapshots_size; i++) {
+        char *address = (char *) current_state.snapshots[i].address;
+        if (address <= (char *) p && (char *) p < address + current_state.snapshots[i].size) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/** Whether the image copies p rather than referring to it as a static object.
+ */
+static bool is_image_object(void *p) {
+#ifdef STELLA_GC_CONSERVATIVE
+    if (find_pinned_run(p)) {
+        return true;
+    }
+#endif
+    return is_from_space(p) || is_to_space(p) || is_nursery(p) || find_large_object(p) || find_snapshot(p);
+}
+
+static size_t image_hash(void *p, size_t capacity) {
+    return (size_t) (((uintptr_t) p >> 3) * 0x9E3779B97F4A7C15ull) & (capacity - 1);
+}
+
+static gc_image_entry *image_entry(gc_image_writer *writer, void *p) {
+    size_t i = image_hash(p, writer->table_capacity);
+    while (writer->table[i].object && writer->table[i].object != p) {
+        i = (i + 1) & (writer->table_capacity - 1);
+    }
+    return &writer->table[i];
+}
+
+static void image_grow_table(gc_image_writer *writer) {
+    gc_image_entry *old = writer->table;
+    size_t old_capacity = writer->table_capacity;
+    writer->table_capacity = MAX(LARGE_OBJECTS_INITIAL_CAPACITY, 2 * old_capacity);
+    writer->table = calloc(writer->table_capacity, sizeof(gc_image_entry));
+    if (!writer->table) {
+        out_of_memory();
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].object) {
+            *image_entry(writer, old[i].object) = old[i];
         }
     }
+    free(old);
+}
 
-    if (node == NULL) {
+static void image_reserve(gc_image_writer *writer, size_t words) {
+    if (writer->words_size + words <= writer->words_capacity) {
         return;
     }
+    size_t capacity = MAX(writer->words_size + words, 2 * writer->words_capacity);
+    writer->words = realloc(writer->words, capacity * sizeof(uint64_t));
+    writer->words_capacity = capacity;
+    if (!writer->words) {
+        out_of_memory();
+    }
+}
+
+static void image_relocate(gc_image_writer *writer, size_t index, uint64_t kind) {
+    if (writer->relocations_size == writer->relocations_capacity) {
+        size_t capacity = MAX(LARGE_OBJECTS_INITIAL_CAPACITY, 2 * writer->relocations_capacity);
+        writer->relocations = realloc(writer->relocations, capacity * sizeof(uint64_t));
+        writer->relocations_capacity = capacity;
+        if (!writer->relocations) {
+            out_of_memory();
+        }
+    }
+    writer->relocations[writer->relocations_size++] = (uint64_t) index << 1 | kind;
+}
+
+/** Offset of the copy of p in the image, copying p (without its fields forwarded yet) if it is not there.
+ */
+static size_t image_copy(gc_image_writer *writer, stella_object *p) {
+    if (2 * (writer->table_size + 1) > writer->table_capacity) {
+        image_grow_table(writer);
+    }
+    gc_image_entry *entry = image_entry(writer, p);
+    if (entry->object) {
+        return entry->offset;
+    }
 
-    gc_root *prev = node->prev;
-    gc_root *next = node->next;
+    if (STELLA_OBJECT_HEADER_TAG(p->object_header) == TAG_REF) {
+        writer->failed = true;
+    }
+    size_t fields_count = STELLA_OBJECT_HEADER_FIELD_COUNT(p->object_header);
+    image_reserve(writer, 1 + fields_count);
+    uint64_t *q = &writer->words[writer->words_size];
+    q[0] = 0;
+    ((stella_object *) q)->object_header = p->object_header
+        & ~(GC_HEADER_FORWARDED | GC_HEADER_REMEMBERED | GC_HEADER_MARKED | GC_HEADER_BUSY);
+    memcpy(&q[1], p->object_fields, fields_count * sizeof(void *));
+
+    entry->object = p;
+    entry->offset = writer->words_size * sizeof(uint64_t);
+    writer->table_size++;
+    writer->words_size += 1 + fields_count;
+    return entry->offset;
+}
 
-    if (prev) {
-        prev->next = next;
+/** Store value in the word at index, copying the object it points to if needed.
+ */
+static void image_store(gc_image_writer *writer, size_t index, void *value) {
+    if (!value || STELLA_IS_IMMEDIATE(value)) {
+        writer->words[index] = (uint64_t) (uintptr_t) value;
+    } else if (is_image_object(value)) {
+        size_t offset = image_copy(writer, (stella_object *) value);
+        writer->words[index] = offset;
+        image_relocate(writer, index, 0);
     } else {
-        current_state.roots_list = next;
+        writer->words[index] = (uint64_t) ((uintptr_t) value - (uintptr_t) &the_ZERO);
+        image_relocate(writer, index, GC_IMAGE_STATIC);
+    }
+}
+
+static bool write_image(const char *path, gc_image_writer *writer) {
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        perror(path);
+        return false;
+    }
+    bool written = fwrite(writer->words, sizeof(uint64_t), writer->words_size, out) == writer->words_size
+                   && fwrite(writer->relocations, sizeof(uint64_t), writer->relocations_size, out)
+                      == writer->relocations_size;
+    if (fclose(out) || !written) {
+        perror(path);
+        return false;
+    }
+    return true;
+}
+
+bool gc_save_snapshot(const char *path, void **objects, size_t count) {
+#ifdef STELLA_GC_MULTI_MUTATOR
+    pthread_mutex_lock(&mutators.lock);
+    park();
+#endif
+#if defined(STELLA_GC_BACKEND_INCREMENTAL) && !defined(STELLA_GC_GENERATIONAL)
+    if (current_state.gc_running) {
+        pause_begin(GC_PAUSE_FULL);
+        finish_collection();
+        pause_end();
+    }
+#endif
+    if (!objects) {
+        count = ROOT_STACK.roots_size;
+    }
+
+    gc_image_writer writer = {0};
+    image_reserve(&writer, GC_IMAGE_HEADER_WORDS + count);
+    writer.words_size = GC_IMAGE_HEADER_WORDS + count;
+    for (size_t i = 0; i < count; i++) {
+        image_store(&writer, GC_IMAGE_HEADER_WORDS + i, objects ? objects[i] : *ROOT_STACK.roots[i]);
+    }
+    // the copied objects are scanned like a Cheney to-space
+    for (size_t scan = GC_IMAGE_HEADER_WORDS + count; scan < writer.words_size && !writer.failed;) {
+        stella_object *obj = (stella_object *) &writer.words[scan];
+        size_t fields_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+        for (size_t i = 0; i < fields_count; i++) {
+            image_store(&writer, scan + 1 + i, (void *) (uintptr_t) writer.words[scan + 1 + i]);
+        }
+        scan += 1 + fields_count;
     }
+#ifdef STELLA_GC_MULTI_MUTATOR
+    pthread_mutex_unlock(&mutators.lock);
+#endif
 
-    if (next) {
-        next->prev = prev;
+    bool saved = false;
+    if (writer.failed) {
+        fprintf(stderr, "%s: a reference cell is reachable, only immutable objects can be saved\n", path);
     } else {
-        current_state.roots_last = prev;
+        gc_image_header header = {
+                .version = GC_IMAGE_VERSION,
+                .word_size = sizeof(void *),
+                .layout = image_layout(),
+                .roots_count = count,
+                .words = writer.words_size,
+                .relocations_count = writer.relocations_size,
+        };
+        memcpy(header.magic, GC_IMAGE_MAGIC, sizeof header.magic);
+        memcpy(writer.words, &header, sizeof header);
+        saved = write_image(path, &writer);
     }
+    free(writer.words);
+    free(writer.relocations);
+    free(writer.table);
+    return saved;
+}
+
+/** Relocate a mapped image in place. Returns false if it is not a valid image of this executable.
+ */
+static bool relocate_image(char *image, size_t size) {
+    gc_image_header *header = (gc_image_header *) image;
+    size_t size_words = size / sizeof(uint64_t);
+    if (size < sizeof(gc_image_header) || memcmp(header->magic, GC_IMAGE_MAGIC, sizeof header->magic)
+        || header->version != GC_IMAGE_VERSION || header->word_size != sizeof(void *)
+        || header->layout != image_layout()) {
+        return false;
+    }
+    // every count is bounded by the size before they are added up, so that the sums cannot overflow
+    if (header->roots_count > size_words || header->words > size_words || header->relocations_count > size_words
+        || header->words < GC_IMAGE_HEADER_WORDS + header->roots_count
+        || (header->words + header->relocations_count) * sizeof(uint64_t) != size) {
+        return false;
+    }
+
+    uint64_t *words = (uint64_t *) image;
+    uint64_t *relocations = &words[header->words];
+    for (size_t i = 0; i < header->relocations_count; i++) {
+        uint64_t index = relocations[i] >> 1;
+        if (index < GC_IMAGE_HEADER_WORDS || index >= header->words) {
+            return false;
+        }
+        if (relocations[i] & GC_IMAGE_STATIC) {
+            words[index] = (uint64_t) ((uintptr_t) &the_ZERO + (uintptr_t) words[index]);
+        } else if (words[index] < header->words * sizeof(uint64_t)) {
+            words[index] = (uint64_t) (uintptr_t) (image + words[index]);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void **gc_load_snapshot(const char *path, size_t *count) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size == 0) {
+        fprintf(stderr, "%s: empty or unreadable heap image\n", path);
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t) st.st_size;
+    // private and writable only while the pointers are relocated
+    char *image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+    if (!relocate_image(image, size)) {
+        fprintf(stderr, "%s: not a heap image of this executable\n", path);
+        munmap(image, size);
+        return NULL;
+    }
+    if (mprotect(image, size, PROT_READ)) {
+        perror(path);
+        munmap(image, size);
+        return NULL;
+    }
+#ifdef STELLA_GC_MULTI_MUTATOR
+    pthread_mutex_lock(&mutators.lock);
+#endif
+    if (current_state.snapshots_size == current_state.snapshots_capacity) {
+        size_t capacity = MAX(4, 2 * current_state.snapshots_capacity);
+        current_state.snapshots = realloc(current_state.snapshots, capacity * sizeof(gc_snapshot));
+        if (!current_state.snapshots) {
+            out_of_memory();
+        }
+        current_state.snapshots_capacity = capacity;
+    }
+    current_state.snapshots[current_state.snapshots_size].address = image;
+    current_state.snapshots[current_state.snapshots_size].size = size;
+    current_state.snapshots_size++;
+#ifdef STELLA_GC_MULTI_MUTATOR
+    pthread_mutex_unlock(&mutators.lock);
+#endif
+
+    *count = ((gc_image_header *) image)->roots_count;
+    return (void **) (image + sizeof(gc_image_header));
+}
+
+#else
+
+bool gc_save_snapshot(const char *path, void **objects, size_t count) {
+    (void) objects;
+    (void) count;
+    fprintf(stderr, "%s: heap images are not supported with STELLA_COMPRESSED_REFS\n", path);
+    return false;
+}
 
-    free(node);
-    current_state.roots_size--;
+void **gc_load_snapshot(const char *path, size_t *count) {
+    (void) count;
+    fprintf(stderr, "%s: heap images are not supported with STELLA_COMPRESSED_REFS\n", path);
+    return NULL;
 }
 
+#endif
+
 static void fmt_commas(size_t v, char *out, size_t cap) {
     char buf[64];
     size_t i = 0, group = 0;
@@ -348,34 +3412,335 @@ static void fmt_pair_bytes_objs(size_t bytes, size_t objs, char *out, size_t cap
     char b[64], o[64];
     fmt_commas(bytes, b, sizeof(b));
     fmt_commas(objs, o, sizeof(o));
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_FULL
     snprintf(out, cap, "%s bytes (%s objects)", b, o);
+#else
+    // objects are only counted at the FULL level
+    snprintf(out, cap, "%s bytes", b);
+#endif
+}
+
+
+static const char *PAUSE_KIND_NAMES[GC_PAUSE_KINDS] = {"step", "minor", "full"};
+
+static const char *STATS_LEVEL_NAMES[] = {"off", "cheap", "full"};
+
+static uint64_t wall_ns() {
+    return stats.start_ns ? now_ns() - stats.start_ns : 0;
+}
+
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+static void print_gc_timings() {
+    uint64_t wall = wall_ns();
+    uint64_t mutator = wall > stats.gc_ns ? wall - stats.gc_ns : 0;
+    printf("- GC time: %.3f ms of %.3f ms wall time (mutator %.3f ms); root forwarding %.3f ms, scanning %.3f ms\n",
+           stats.gc_ns / 1e6, wall / 1e6, mutator / 1e6, stats.root_forwarding_ns / 1e6, stats.scan_ns / 1e6);
+    if (mutator) {
+        printf("- Allocation rate: %.1f MB/s of mutator time\n",
+               (double) stats.total_allocated_bytes / 1e6 / ((double) mutator / 1e9));
+    }
+    for (int kind = 0; kind < GC_PAUSE_KINDS; kind++) {
+        const gc_histogram *pauses = &stats.pauses[kind];
+        if (!pauses->count) {
+            continue;
+        }
+        char counts[64];
+        fmt_commas(pauses->count, counts, sizeof counts);
+        printf("- Pauses (%s): %s, p50 %.1f us, p99 %.1f us, max %.1f us\n", PAUSE_KIND_NAMES[kind], counts,
+               histogram_percentile(pauses, 0.5) / 1e3, histogram_percentile(pauses, 0.99) / 1e3,
+               pauses->max_ns / 1e3);
+    }
 }
+#endif
 
+#ifdef STELLA_GC_GENERATIONAL
+#define GENERATIONAL_SUFFIX ", generational"
+#else
+#define GENERATIONAL_SUFFIX ""
+#endif
+
+#ifdef STELLA_GC_BACKEND_COMPACT
+#define HEAP_SIZE_UNIT "in one space"
+#else
+#define HEAP_SIZE_UNIT "per semispace"
+#endif
 
 void print_gc_alloc_stats() {
+    update_residency();
+    printf("Garbage collector (GC) statistics:\n");
+#ifdef STELLA_GC_BACKEND_INCREMENTAL
+    printf("- Collector: incremental copying (Baker)%s\n", GENERATIONAL_SUFFIX);
+#elif defined(STELLA_GC_BACKEND_CHENEY)
+    printf("- Collector: stop-the-world copying (Cheney)%s\n", GENERATIONAL_SUFFIX);
+#else
+    printf("- Collector: stop-the-world mark-compact (sliding)\n");
+#endif
+#if STELLA_GC_STATS_LEVEL == STELLA_GC_STATS_OFF
+    printf("- Statistics are disabled (STELLA_GC_STATS_LEVEL is off)\n");
+#else
     char totalalloc[96], maxres[96], curres[96];
     fmt_pair_bytes_objs(stats.total_allocated_bytes, stats.total_allocated, totalalloc, sizeof totalalloc);
     fmt_pair_bytes_objs(stats.maximum_residency_bytes, stats.maximum_residency, maxres, sizeof maxres);
     fmt_pair_bytes_objs(stats.residency_bytes, stats.residency, curres, sizeof curres);
-
-    char readss[64], writess[64], rbs[64], wbs[64], cycless[64];
-    fmt_commas(stats.reads, readss, sizeof readss);
-    fmt_commas(stats.writes, writess, sizeof writess);
-    fmt_commas(stats.read_barriers, rbs, sizeof rbs);
-    fmt_commas(stats.write_barriers, wbs, sizeof wbs);
+    char cycless[64];
     fmt_commas(stats.gc_cycles, cycless, sizeof cycless);
-
-    printf("Garbage collector (GC) statistics:\n");
     printf("- Total memory allocation: %s\n", totalalloc);
     printf("- GC cycles: %s\n", cycless);
+#ifdef STELLA_GC_GENERATIONAL
+    char minors[64], majors[64], promoted[96];
+    fmt_commas(stats.minor_gc_cycles, minors, sizeof minors);
+    fmt_commas(stats.major_gc_cycles, majors, sizeof majors);
+    fmt_pair_bytes_objs(stats.promoted_bytes, stats.promoted, promoted, sizeof promoted);
+    printf("- GC cycles per generation: %s minor (nursery), %s major (old generation)\n", minors, majors);
+    printf("- Promoted to old generation: %s\n", promoted);
+#endif
+    char heaps[64], peaks[64], growss[64], shrinkss[64];
+    fmt_commas(stats.heap_size, heaps, sizeof heaps);
+    fmt_commas(stats.peak_heap_size, peaks, sizeof peaks);
+    fmt_commas(stats.heap_grows, growss, sizeof growss);
+    fmt_commas(stats.heap_shrinks, shrinkss, sizeof shrinkss);
+    printf("- Heap size: %s bytes %s (peak %s bytes, grown %s times, shrunk %s times)\n",
+           heaps, HEAP_SIZE_UNIT, peaks, growss, shrinkss);
+    char larges[64], largebytess[64], largeallocs[64], largefreeds[64];
+    fmt_commas(current_state.large_objects_size, larges, sizeof larges);
+    fmt_commas(current_state.large_objects_bytes, largebytess, sizeof largebytess);
+    fmt_commas(stats.large_objects_allocated, largeallocs, sizeof largeallocs);
+    fmt_commas(stats.large_objects_freed, largefreeds, sizeof largefreeds);
+    printf("- Large objects: %s (%s bytes), %s allocated, %s freed\n", larges, largebytess, largeallocs, largefreeds);
+#ifdef STELLA_GC_CONSERVATIVE
+    char ambiguouss[64], pinneds[64], pinnednows[64];
+    fmt_commas(stats.ambiguous_roots, ambiguouss, sizeof ambiguouss);
+    fmt_commas(stats.pinned_bytes, pinneds, sizeof pinneds);
+    fmt_commas(current_state.pinned_bytes, pinnednows, sizeof pinnednows);
+    printf("- Conservative roots: %s ambiguous roots, %s bytes pinned in place (now %s bytes in %zu runs)\n",
+           ambiguouss, pinneds, pinnednows, current_state.pinned_runs_size);
+#endif
+#if defined(STELLA_GC_BACKEND_INCREMENTAL) && !defined(STELLA_GC_GENERATIONAL)
+    char stepss[64], scanneds[64];
+    fmt_commas(stats.incremental_steps, stepss, sizeof stepss);
+    fmt_commas(stats.incremental_scanned_bytes, scanneds, sizeof scanneds);
+    printf("- Incremental steps: %s (%s bytes scanned; work ratio %.2f, step budget %lu us)\n",
+           stepss, scanneds, current_state.work_ratio, current_state.step_budget_us);
+#endif
+#ifdef STELLA_GC_PARALLEL
+    char parallels[64];
+    fmt_commas(stats.parallel_cycles, parallels, sizeof parallels);
+    printf("- Parallel evacuation: %zu threads, %s parallel cycles\n", stats.gc_workers, parallels);
+    for (size_t i = 0; i < stats.gc_workers; i++) {
+        char copied[96], scanneds[64], stealss[64];
+        fmt_pair_bytes_objs(stats.workers[i].copied_bytes, stats.workers[i].copied, copied, sizeof copied);
+        fmt_commas(stats.workers[i].scanned, scanneds, sizeof scanneds);
+        fmt_commas(stats.workers[i].steals, stealss, sizeof stealss);
+        printf("  - thread %zu: copied %s, scanned %s objects, %s steals\n", i, copied, scanneds, stealss);
+    }
+#endif
+    print_gc_timings();
     printf("- Maximum residency: %s\n", maxres);
     printf("- Current residency: %s\n", curres);
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_FULL
+    char readss[64], writess[64], rbs[64], wbs[64];
+    fmt_commas(stats.reads, readss, sizeof readss);
+    fmt_commas(stats.writes, writess, sizeof writess);
+    fmt_commas(stats.read_barriers, rbs, sizeof rbs);
+    fmt_commas(stats.write_barriers, wbs, sizeof wbs);
     printf("- Total memory use: %s reads and %s writes\n", readss, writess);
     printf("- Barrier hits: %s read, %s write\n", rbs, wbs);
+#endif
+#ifdef STELLA_GC_PROFILE
+    printf("- Allocation by tag (objects by fields count):\n");
+    for (size_t tag = 0; tag < PROFILE_TAGS; tag++) {
+        size_t bytes = 0, objects = 0;
+        for (size_t size_class = 0; size_class < GC_PROFILE_SIZE_CLASSES; size_class++) {
+            bytes += GC_CONTEXT->profile.allocated_bytes[tag][size_class];
+            objects += GC_CONTEXT->profile.allocated[tag][size_class];
+        }
+        if (!objects) {
+            continue;
+        }
+        char bytess[64], objectss[64];
+        fmt_commas(bytes, bytess, sizeof bytess);
+        fmt_commas(objects, objectss, sizeof objectss);
+        printf("  - %s: %s bytes (%s objects;", profile_tag_names[tag], bytess, objectss);
+        for (size_t size_class = 0; size_class < GC_PROFILE_SIZE_CLASSES; size_class++) {
+            if (GC_CONTEXT->profile.allocated[tag][size_class]) {
+                fmt_commas(GC_CONTEXT->profile.allocated[tag][size_class], objectss, sizeof objectss);
+                printf(" %s: %s", profile_size_class_names[size_class], objectss);
+            }
+        }
+        printf(")\n");
+    }
+#endif
+#endif
+}
+
+void gc_update_stats() {
+    update_residency();
+}
+
+gc_stats *gc_current_stats() {
+    return &stats;
+}
 
+gc_state *gc_current_state() {
+    return &current_state;
+}
+
+void print_gc_stats_json(FILE *out) {
+    update_residency();
+    uint64_t wall = wall_ns();
+    uint64_t mutator = wall > stats.gc_ns ? wall - stats.gc_ns : 0;
+    fprintf(out, "{\n");
+#ifdef STELLA_GC_BACKEND_INCREMENTAL
+    fprintf(out, "  \"collector\": \"incremental\",\n");
+#elif defined(STELLA_GC_BACKEND_CHENEY)
+    fprintf(out, "  \"collector\": \"cheney\",\n");
+#else
+    fprintf(out, "  \"collector\": \"compact\",\n");
+#endif
+#ifdef STELLA_GC_GENERATIONAL
+    fprintf(out, "  \"generational\": true,\n");
+#else
+    fprintf(out, "  \"generational\": false,\n");
+#endif
+    fprintf(out, "  \"stats_level\": \"%s\",\n", STATS_LEVEL_NAMES[STELLA_GC_STATS_LEVEL]);
+    fprintf(out, "  \"total_allocated_bytes\": %zu,\n", stats.total_allocated_bytes);
+    fprintf(out, "  \"total_allocated\": %zu,\n", stats.total_allocated);
+    fprintf(out, "  \"maximum_residency_bytes\": %zu,\n", stats.maximum_residency_bytes);
+    fprintf(out, "  \"maximum_residency\": %zu,\n", stats.maximum_residency);
+    fprintf(out, "  \"residency_bytes\": %zu,\n", stats.residency_bytes);
+    fprintf(out, "  \"residency\": %zu,\n", stats.residency);
+    fprintf(out, "  \"reads\": %zu,\n", stats.reads);
+    fprintf(out, "  \"writes\": %zu,\n", stats.writes);
+    fprintf(out, "  \"read_barriers\": %zu,\n", stats.read_barriers);
+    fprintf(out, "  \"write_barriers\": %zu,\n", stats.write_barriers);
+    fprintf(out, "  \"gc_cycles\": %zu,\n", stats.gc_cycles);
+    fprintf(out, "  \"minor_gc_cycles\": %zu,\n", stats.minor_gc_cycles);
+    fprintf(out, "  \"major_gc_cycles\": %zu,\n", stats.major_gc_cycles);
+    fprintf(out, "  \"promoted_bytes\": %zu,\n", stats.promoted_bytes);
+    fprintf(out, "  \"promoted\": %zu,\n", stats.promoted);
+    fprintf(out, "  \"heap_size\": %zu,\n", stats.heap_size);
+    fprintf(out, "  \"peak_heap_size\": %zu,\n", stats.peak_heap_size);
+    fprintf(out, "  \"heap_grows\": %zu,\n", stats.heap_grows);
+    fprintf(out, "  \"heap_shrinks\": %zu,\n", stats.heap_shrinks);
+    fprintf(out, "  \"incremental_steps\": %zu,\n", stats.incremental_steps);
+    fprintf(out, "  \"incremental_scanned_bytes\": %zu,\n", stats.incremental_scanned_bytes);
+    fprintf(out, "  \"large_objects\": %zu,\n", current_state.large_objects_size);
+    fprintf(out, "  \"large_objects_bytes\": %zu,\n", current_state.large_objects_bytes);
+    fprintf(out, "  \"large_objects_allocated\": %zu,\n", stats.large_objects_allocated);
+    fprintf(out, "  \"large_objects_freed\": %zu,\n", stats.large_objects_freed);
+    fprintf(out, "  \"ambiguous_roots\": %zu,\n", stats.ambiguous_roots);
+    fprintf(out, "  \"pinned_bytes\": %zu,\n", stats.pinned_bytes);
+    fprintf(out, "  \"gc_workers\": %zu,\n", stats.gc_workers);
+    fprintf(out, "  \"parallel_cycles\": %zu,\n", stats.parallel_cycles);
+    fprintf(out, "  \"workers\": [");
+    for (size_t i = 0; i < stats.gc_workers; i++) {
+        fprintf(out, "%s{\"copied_bytes\": %zu, \"copied\": %zu, \"scanned\": %zu, \"steals\": %zu}",
+                i ? ", " : "", stats.workers[i].copied_bytes, stats.workers[i].copied,
+                stats.workers[i].scanned, stats.workers[i].steals);
+    }
+    fprintf(out, "],\n");
+    fprintf(out, "  \"wall_ns\": %llu,\n", (unsigned long long) wall);
+    fprintf(out, "  \"gc_ns\": %llu,\n", (unsigned long long) stats.gc_ns);
+    fprintf(out, "  \"mutator_ns\": %llu,\n", (unsigned long long) mutator);
+    fprintf(out, "  \"root_forwarding_ns\": %llu,\n", (unsigned long long) stats.root_forwarding_ns);
+    fprintf(out, "  \"scan_ns\": %llu,\n", (unsigned long long) stats.scan_ns);
+    fprintf(out, "  \"allocation_rate_bytes_per_s\": %.0f,\n",
+            mutator ? (double) stats.total_allocated_bytes / ((double) mutator / 1e9) : 0.0);
+    fprintf(out, "  \"pauses\": {\n");
+    for (int kind = 0; kind < GC_PAUSE_KINDS; kind++) {
+        const gc_histogram *pauses = &stats.pauses[kind];
+        fprintf(out, "    \"%s\": {\"count\": %zu, \"total_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+                     "\"max_ns\": %llu, \"buckets\": [",
+                PAUSE_KIND_NAMES[kind], pauses->count, (unsigned long long) pauses->total_ns,
+                (unsigned long long) histogram_percentile(pauses, 0.5),
+                (unsigned long long) histogram_percentile(pauses, 0.99),
+                (unsigned long long) pauses->max_ns);
+        for (int bucket = 0; bucket < GC_HISTOGRAM_BUCKETS; bucket++) {
+            fprintf(out, bucket ? ", %zu" : "%zu", pauses->buckets[bucket]);
+        }
+        fprintf(out, kind + 1 < GC_PAUSE_KINDS ? "]},\n" : "]}\n");
+    }
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+}
+
+#ifdef STELLA_GC_TRACE
+
+void print_gc_trace_json(FILE *out) {
+    gc_trace_event *events = __atomic_load_n(&trace.events, __ATOMIC_ACQUIRE);
+    size_t next = events ? __atomic_load_n(&trace.next, __ATOMIC_RELAXED) : 0;
+    size_t first = next > trace.capacity ? next - trace.capacity : 0;
+    int pid = (int) getpid();
+    fprintf(out, "{\n");
+    fprintf(out, "  \"displayTimeUnit\": \"ms\",\n");
+    fprintf(out, "  \"otherData\": {\"recorded_events\": %zu, \"dropped_events\": %zu},\n", next, first);
+    fprintf(out, "  \"traceEvents\": [\n");
+    fprintf(out, "    {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"stella\"}}", pid);
+    for (size_t i = first; i < next; i++) {
+        const gc_trace_event *event = &events[i % trace.capacity];
+        const char *name = trace_kinds[event->kind].name;
+        char phase = trace_kinds[event->kind].phase;
+        fprintf(out, ",\n    {\"name\": \"%s\", \"cat\": \"gc\", \"ph\": \"%c\", \"ts\": %.3f, ",
+                name, phase, (double) event->start_ns / 1e3);
+        if (phase == 'X') {
+            fprintf(out, "\"dur\": %.3f, ", (double) event->duration_ns / 1e3);
+        } else {
+            fprintf(out, "\"s\": \"t\", ");
+        }
+        fprintf(out, "\"pid\": %d, \"tid\": %u, \"args\": {", pid, event->thread);
+        for (int arg = 0; arg < 2 && trace_kinds[event->kind].args[arg]; arg++) {
+            fprintf(out, "%s\"%s\": %llu", arg ? ", " : "", trace_kinds[event->kind].args[arg],
+                    (unsigned long long) event->args[arg]);
+        }
+        fprintf(out, "}}");
+        if (event->kind == GC_TRACE_RESIZE) {
+            fprintf(out, ",\n    {\"name\": \"heap\", \"cat\": \"gc\", \"ph\": \"C\", \"ts\": %.3f, "
+                         "\"pid\": %d, \"args\": {\"bytes\": %llu}}",
+                    (double) event->start_ns / 1e3, pid, (unsigned long long) event->args[1]);
+        }
+    }
+    fprintf(out, "\n  ]\n");
+    fprintf(out, "}\n");
+}
+
+#endif
+
+/** Bytes of the heap space [start, start + size) currently in RAM.
+ */
+static size_t resident_bytes(void *start, size_t size) {
+    if (!start || !size) {
+        return 0;
+    }
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    uintptr_t from = (uintptr_t) start & ~(page - 1);
+    size_t pages = ((uintptr_t) start + size - from + page - 1) / page;
+    unsigned char *residency = malloc(pages);
+    size_t resident = 0;
+    if (residency && !mincore((void *) from, pages * page, residency)) {
+        for (size_t i = 0; i < pages; i++) {
+            resident += residency[i] & 1;
+        }
+    }
+    free(residency);
+    return MIN(resident * page, size);
+}
+
+/** Resident set size of the process in bytes, 0 where /proc is not available.
+ */
+static size_t process_rss() {
+    unsigned long size, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%lu %lu", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return resident * (size_t) sysconf(_SC_PAGESIZE);
 }
 
 void print_gc_state() {
+    update_residency();
     char curres[96];
     fmt_pair_bytes_objs(stats.residency_bytes, stats.residency, curres, sizeof curres);
     size_t free_memory = current_state.limit - current_state.scan;
@@ -384,6 +3749,27 @@ void print_gc_state() {
     printf("- Total scan: %p, next: %p, limit: %p\n", current_state.scan, current_state.next, current_state.limit);
     printf("- Current allocated: %s\n", curres);
     printf("- Total free memory : %zu\n", free_memory);
+    printf("- Large objects: %zu (%zu bytes)\n", current_state.large_objects_size, current_state.large_objects_bytes);
+    size_t snapshot_bytes = 0;
+    for (size_t i = 0; i < current_state.snapshots_size; i++) {
+        snapshot_bytes += current_state.snapshots[i].size;
+    }
+    printf("- Snapshots: %zu (%zu bytes)\n", current_state.snapshots_size, snapshot_bytes);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("- Process RSS: %zu bytes (peak %zu)\n", process_rss(), (size_t) usage.ru_maxrss * 1024);
+    printf("- Resident from-space: %zu of %zu bytes, to-space: %zu of %zu bytes\n",
+           resident_bytes(current_state.from_space, current_state.from_space_size), current_state.from_space_size,
+           resident_bytes(current_state.to_space, current_state.to_space_size), current_state.to_space_size);
+    printf("- Released to the OS: %zu bytes (release %s, huge pages %s)\n", current_state.released_bytes,
+           release_names[current_state.release_policy], page_names[current_state.page_kind]);
+#ifdef STELLA_GC_GENERATIONAL
+    printf("- Nursery: %p, next: %p, limit: %p\n",
+           current_state.nursery, current_state.nursery_next, current_state.nursery_limit);
+    printf("- Remembered set: %zu objects\n", current_state.remembered_size);
+    printf("- Resident nursery: %zu of %zu bytes\n",
+           resident_bytes(current_state.nursery, current_state.nursery_size), current_state.nursery_size);
+#endif
     print_gc_roots();
 }
 
@@ -402,18 +3788,10 @@ static size_t ptr_to_str(char *buf, size_t cap, const void *p) {
     return (size_t) snprintf(buf, cap, "(null)");
 }
 
-static void print_border(FILE *out,
-                         size_t widx, size_t wnode, size_t wprev,
-                         size_t wnext, size_t wslot, size_t wval) {
+static void print_border(FILE *out, size_t widx, size_t wslot, size_t wval) {
     fputc('+', out);
     for (size_t i = 0; i < widx + 2; ++i) fputc('-', out);
     fputc('+', out);
-    for (size_t i = 0; i < wnode + 2; ++i) fputc('-', out);
-    fputc('+', out);
-    for (size_t i = 0; i < wprev + 2; ++i) fputc('-', out);
-    fputc('+', out);
-    for (size_t i = 0; i < wnext + 2; ++i) fputc('-', out);
-    fputc('+', out);
     for (size_t i = 0; i < wslot + 2; ++i) fputc('-', out);
     fputc('+', out);
     for (size_t i = 0; i < wval + 2; ++i) fputc('-', out);
@@ -426,88 +3804,59 @@ void print_gc_roots() {
     FILE *out = stdout;
 
 
-    if (!current_state.roots_list) {
-        fprintf(out, "GC roots: empty list (head=%p, tail=%p)\n",
-                (void *) current_state.roots_list, (void *) current_state.roots_last);
+    if (!ROOT_STACK.roots_size) {
+        fprintf(out, "GC roots: empty stack (base=%p, capacity=%zu)\n",
+                (void *) ROOT_STACK.roots, ROOT_STACK.roots_capacity);
         return;
     }
 
 
     const char *H_IDX = "#";
-    const char *H_NODE = "node";
-    const char *H_PREV = "prev";
-    const char *H_NEXT = "next";
     const char *H_SLOT = "slot";
     const char *H_VAL = "*slot";
 
 
     size_t widx = strlen(H_IDX);
-    size_t wnode = strlen(H_NODE);
-    size_t wprev = strlen(H_PREV);
-    size_t wnext = strlen(H_NEXT);
     size_t wslot = strlen(H_SLOT);
     size_t wval = strlen(H_VAL);
 
-    size_t nrows = 0;
-    for (gc_root *n = current_state.roots_list; n; n = n->next) {
+    size_t nrows = ROOT_STACK.roots_size;
+    for (size_t i = 0; i < nrows; i++) {
         char buf[32];
         size_t len;
 
-        len = ptr_to_str(buf, sizeof(buf), (const void *) n);
-        if (len > wnode) wnode = len;
-
-        len = ptr_to_str(buf, sizeof(buf), (const void *) n->prev);
-        if (len > wprev) wprev = len;
-
-        len = ptr_to_str(buf, sizeof(buf), (const void *) n->next);
-        if (len > wnext) wnext = len;
-
-        len = ptr_to_str(buf, sizeof(buf), (const void *) n->content);
+        len = ptr_to_str(buf, sizeof(buf), (const void *) ROOT_STACK.roots[i]);
         if (len > wslot) wslot = len;
 
-        void *val = n->content ? *n->content : NULL;
-        len = ptr_to_str(buf, sizeof(buf), (const void *) val);
+        len = ptr_to_str(buf, sizeof(buf), (const void *) *ROOT_STACK.roots[i]);
         if (len > wval) wval = len;
-
-        ++nrows;
     }
 
-    size_t idxdigits = size_len(nrows ? (nrows - 1) : 0);
+    size_t idxdigits = size_len(nrows - 1);
     if (idxdigits > widx) widx = idxdigits;
 
 
-    print_border(out, widx, wnode, wprev, wnext, wslot, wval);
-    fprintf(out, "| %-*s | %-*s | %-*s | %-*s | %-*s | %-*s |\n",
+    print_border(out, widx, wslot, wval);
+    fprintf(out, "| %-*s | %-*s | %-*s |\n",
             (int) widx, H_IDX,
-            (int) wnode, H_NODE,
-            (int) wprev, H_PREV,
-            (int) wnext, H_NEXT,
             (int) wslot, H_SLOT,
             (int) wval, H_VAL);
-    print_border(out, widx, wnode, wprev, wnext, wslot, wval);
+    print_border(out, widx, wslot, wval);
 
-    size_t i = 0;
-    for (gc_root *n = current_state.roots_list; n; n = n->next, ++i) {
-        char snode[32], sprev[32], snext[32], sslot[32], sval[32], sidx[32];
-
-        ptr_to_str(snode, sizeof(snode), (const void *) n);
-        ptr_to_str(sprev, sizeof(sprev), (const void *) n->prev);
-        ptr_to_str(snext, sizeof(snext), (const void *) n->next);
-        ptr_to_str(sslot, sizeof(sslot), (const void *) n->content);
-        void *val = n->content ? *n->content : NULL;
-        ptr_to_str(sval, sizeof(sval), (const void *) val);
+    for (size_t i = 0; i < nrows; i++) {
+        char sslot[32], sval[32], sidx[32];
+
+        ptr_to_str(sslot, sizeof(sslot), (const void *) ROOT_STACK.roots[i]);
+        ptr_to_str(sval, sizeof(sval), (const void *) *ROOT_STACK.roots[i]);
         snprintf(sidx, sizeof(sidx), "%zu", i);
 
-        fprintf(out, "| %-*s | %-*s | %-*s | %-*s | %-*s | %-*s |\n",
+        fprintf(out, "| %-*s | %-*s | %-*s |\n",
                 (int) widx, sidx,
-                (int) wnode, snode,
-                (int) wprev, sprev,
-                (int) wnext, snext,
                 (int) wslot, sslot,
                 (int) wval, sval);
     }
 
-    print_border(out, widx, wnode, wprev, wnext, wslot, wval);
-    fprintf(out, "All roots: %zu (head=%p, tail=%p)\n",
-            nrows, (void *) current_state.roots_list, (void *) current_state.roots_last);
+    print_border(out, widx, wslot, wval);
+    fprintf(out, "All roots: %zu (base=%p, capacity=%zu)\n",
+            nrows, (void *) ROOT_STACK.roots, ROOT_STACK.roots_capacity);
 }
@@ -1,10 +1,12 @@
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #include "stella/runtime.h"
 #include "stella/gc.h"
 
-int total_allocated_fields = 0;
+// kept with the heap, so that each context counts its own
+#define total_allocated_fields (GC_CONTEXT->allocated_fields)
 
 stella_object the_ZERO = { .object_header = TAG_ZERO, .object_fields = {} } ;
 stella_object the_UNIT = { .object_header = TAG_UNIT, .object_fields = {} } ;
@@ -15,9 +17,118 @@ stella_object the_TRUE = { .object_header = TAG_TRUE, .object_fields = {} } ;
 const int FIELD_COUNT_MASK = (1 << 8) - (1 << 4) ;
 const int TAG_MASK         = (1 << 4) - (1 << 0) ;
 
+#if STELLA_SMALL_NATS > 0
+#ifdef STELLA_COMPRESSED_REFS
+stella_object_1 the_SMALL_NATS[STELLA_SMALL_NATS];
+
+// a field holds an offset from STELLA_HEAP_BASE, which is not a constant expression,
+// so the cells are linked before main
+__attribute__((constructor)) static void link_small_nats() {
+  for (int i = 0; i < STELLA_SMALL_NATS; i++) {
+    the_SMALL_NATS[i].object_header = TAG_SUCC | (1 << 4);
+    the_SMALL_NATS[i].object_fields[0] = STELLA_FIELD_ENCODE(i ? (void*)&the_SMALL_NATS[i - 1] : (void*)&the_ZERO);
+  }
+}
+#else
+// the cell for n points to the one for n - 1: the cells after the first are listed
+// by splitting their count into powers of two, each run starting where the larger ones end
+#define SMALL_NAT_CELL(i) { .object_header = TAG_SUCC | (1 << 4), .object_fields = { (void*)&the_SMALL_NATS[(i) - 1] } },
+#define SMALL_NAT_CELLS_1(i) SMALL_NAT_CELL(i)
+#define SMALL_NAT_CELLS_2(i) SMALL_NAT_CELLS_1(i) SMALL_NAT_CELLS_1((i) + 1)
+#define SMALL_NAT_CELLS_4(i) SMALL_NAT_CELLS_2(i) SMALL_NAT_CELLS_2((i) + 2)
+#define SMALL_NAT_CELLS_8(i) SMALL_NAT_CELLS_4(i) SMALL_NAT_CELLS_4((i) + 4)
+#define SMALL_NAT_CELLS_16(i) SMALL_NAT_CELLS_8(i) SMALL_NAT_CELLS_8((i) + 8)
+#define SMALL_NAT_CELLS_32(i) SMALL_NAT_CELLS_16(i) SMALL_NAT_CELLS_16((i) + 16)
+#define SMALL_NAT_CELLS_64(i) SMALL_NAT_CELLS_32(i) SMALL_NAT_CELLS_32((i) + 32)
+#define SMALL_NAT_CELLS_128(i) SMALL_NAT_CELLS_64(i) SMALL_NAT_CELLS_64((i) + 64)
+#define SMALL_NAT_CELLS_256(i) SMALL_NAT_CELLS_128(i) SMALL_NAT_CELLS_128((i) + 128)
+#define SMALL_NAT_CELLS_512(i) SMALL_NAT_CELLS_256(i) SMALL_NAT_CELLS_256((i) + 256)
+#define SMALL_NAT_CELLS_1024(i) SMALL_NAT_CELLS_512(i) SMALL_NAT_CELLS_512((i) + 512)
+#define SMALL_NAT_CELLS_2048(i) SMALL_NAT_CELLS_1024(i) SMALL_NAT_CELLS_1024((i) + 1024)
+#define SMALL_NAT_CELLS_4096(i) SMALL_NAT_CELLS_2048(i) SMALL_NAT_CELLS_2048((i) + 2048)
+#define SMALL_NAT_CELLS_8192(i) SMALL_NAT_CELLS_4096(i) SMALL_NAT_CELLS_4096((i) + 4096)
+#define SMALL_NAT_CELLS_16384(i) SMALL_NAT_CELLS_8192(i) SMALL_NAT_CELLS_8192((i) + 8192)
+#define SMALL_NAT_REST (STELLA_SMALL_NATS - 1)
+#define SMALL_NAT_RUN_START(run) (1 + (SMALL_NAT_REST & ~(2 * (run) - 1)))
+
+const stella_object_1 the_SMALL_NATS[STELLA_SMALL_NATS] = {
+  { .object_header = TAG_SUCC | (1 << 4), .object_fields = { (void*)&the_ZERO } },
+#if SMALL_NAT_REST & 16384
+  SMALL_NAT_CELLS_16384(SMALL_NAT_RUN_START(16384))
+#endif
+#if SMALL_NAT_REST & 8192
+  SMALL_NAT_CELLS_8192(SMALL_NAT_RUN_START(8192))
+#endif
+#if SMALL_NAT_REST & 4096
+  SMALL_NAT_CELLS_4096(SMALL_NAT_RUN_START(4096))
+#endif
+#if SMALL_NAT_REST & 2048
+  SMALL_NAT_CELLS_2048(SMALL_NAT_RUN_START(2048))
+#endif
+#if SMALL_NAT_REST & 1024
+  SMALL_NAT_CELLS_1024(SMALL_NAT_RUN_START(1024))
+#endif
+#if SMALL_NAT_REST & 512
+  SMALL_NAT_CELLS_512(SMALL_NAT_RUN_START(512))
+#endif
+#if SMALL_NAT_REST & 256
+  SMALL_NAT_CELLS_256(SMALL_NAT_RUN_START(256))
+#endif
+#if SMALL_NAT_REST & 128
+  SMALL_NAT_CELLS_128(SMALL_NAT_RUN_START(128))
+#endif
+#if SMALL_NAT_REST & 64
+  SMALL_NAT_CELLS_64(SMALL_NAT_RUN_START(64))
+#endif
+#if SMALL_NAT_REST & 32
+  SMALL_NAT_CELLS_32(SMALL_NAT_RUN_START(32))
+#endif
+#if SMALL_NAT_REST & 16
+  SMALL_NAT_CELLS_16(SMALL_NAT_RUN_START(16))
+#endif
+#if SMALL_NAT_REST & 8
+  SMALL_NAT_CELLS_8(SMALL_NAT_RUN_START(8))
+#endif
+#if SMALL_NAT_REST & 4
+  SMALL_NAT_CELLS_4(SMALL_NAT_RUN_START(4))
+#endif
+#if SMALL_NAT_REST & 2
+  SMALL_NAT_CELLS_2(SMALL_NAT_RUN_START(2))
+#endif
+#if SMALL_NAT_REST & 1
+  SMALL_NAT_CELLS_1(SMALL_NAT_RUN_START(1))
+#endif
+};
+#endif
+
+// the shared object for n, 1 <= n <= STELLA_SMALL_NATS
+static stella_object* small_nat(int n) {
+  return (stella_object*)&the_SMALL_NATS[n - 1];
+}
+
+// the n represented by a shared object, or 0 if obj is not one of them
+static int small_nat_value(stella_object* obj) {
+  uintptr_t offset = (uintptr_t)obj - (uintptr_t)the_SMALL_NATS;
+  if (offset >= sizeof(the_SMALL_NATS)) {
+    return 0;
+  }
+  return (int)(offset / sizeof(stella_object_1)) + 1;
+}
+
+stella_object *stella_shared_succ(stella_object* n) {
+  if (n == &the_ZERO) {
+    return small_nat(1);
+  }
+  int value = small_nat_value(n);
+  return value && value < STELLA_SMALL_NATS ? small_nat(value + 1) : NULL;
+}
+#endif
+
 stella_object* alloc_stella_object(enum TAG tag, int fields_count) {
   stella_object *obj;
+#ifdef STELLA_RUNTIME_STATS
   total_allocated_fields += fields_count;
+#endif
   switch (tag) {
     // do not allocate constant objects
     case TAG_ZERO: return &the_ZERO;
@@ -28,29 +139,115 @@ stella_object* alloc_stella_object(enum TAG tag, int fields_count) {
     case TAG_TUPLE: if (fields_count == 0) { return &the_EMPTY_TUPLE; }
     // allocate an object with at least one field (or an unknown tag)
     default:
-      obj = gc_alloc(sizeof(stella_object) + fields_count * sizeof(void*));
+      obj = gc_alloc(sizeof(stella_object) + fields_count * sizeof(stella_field));
       STELLA_OBJECT_INIT_TAG(obj, tag);
       STELLA_OBJECT_INIT_FIELDS_COUNT(obj, fields_count);
+#ifdef STELLA_GC_PROFILE
+      gc_profile_allocation(obj);
+#endif
       return obj;
   }
 }
 
+stella_object* alloc_stella_object_bulk(gc_bulk *bulk, enum TAG tag, int fields_count) {
+  stella_object *obj = (stella_object*)bulk->next;
+  size_t size = GC_OBJECT_SIZE(fields_count);
+  assert(bulk->next != NULL && bulk->next + size <= bulk->end);
+  if (bulk->next == NULL || size > (size_t) (bulk->end - bulk->next)) {
+    // an empty run, or more objects taken than it was reserved for
+    return NULL;
+  }
+#ifdef STELLA_RUNTIME_STATS
+  total_allocated_fields += fields_count;
+#endif
+  bulk->next += size;
+  obj->object_header = 0;
+  STELLA_OBJECT_INIT_TAG(obj, tag);
+  STELLA_OBJECT_INIT_FIELDS_COUNT(obj, fields_count);
+#ifdef STELLA_GC_PROFILE
+  gc_profile_allocation(obj);
+#endif
+  return obj;
+}
+
+stella_object *stella_object_succ(stella_object* n) {
+  stella_object *x;
+#ifdef STELLA_IMMEDIATE_NATS
+  if (n == &the_ZERO) {
+    return STELLA_IMMEDIATE_NAT(1);
+  }
+  if (STELLA_IS_IMMEDIATE(n)) {
+    return STELLA_IMMEDIATE_NAT(STELLA_IMMEDIATE_NAT_VALUE(n) + 1);
+  }
+#endif
+#if STELLA_SMALL_NATS > 0
+  stella_object *shared = stella_shared_succ(n);
+  if (shared) {
+    return shared;
+  }
+#endif
+  // with STELLA_GC_CONSERVATIVE the locals are found on the native stack instead
+#ifndef STELLA_GC_CONSERVATIVE
+  gc_push_root((void*)&n);
+#endif
+  x = alloc_stella_object(TAG_SUCC, 1);
+  STELLA_OBJECT_INIT_FIELD(x, 0, n);
+#ifndef STELLA_GC_CONSERVATIVE
+  gc_pop_root((void*)&n);
+#endif
+  return x;
+}
+
 stella_object *nat_to_stella_object(int n) {
+#ifdef STELLA_IMMEDIATE_NATS
+  if (n > 0) {
+    return STELLA_IMMEDIATE_NAT(n);
+  }
+#endif
   stella_object *result, *x;
+  int i = n;
+#ifndef STELLA_GC_CONSERVATIVE
   gc_push_root((void*)&result);    // it is sufficient to push only result
+#endif
   result = &the_ZERO;
-  for (int i = n; i > 0; i--) {
-    x = alloc_stella_object(TAG_SUCC, 1);
-    STELLA_OBJECT_INIT_FIELD(x, 0, result);
-    result = x;
+#if STELLA_SMALL_NATS > 0
+  // only the part above the shared objects is allocated
+  if (n > 0) {
+    result = small_nat(MIN(n, STELLA_SMALL_NATS));
+    i = n - MIN(n, STELLA_SMALL_NATS);
   }
+#endif
+  // the chain is built a run at a time: nothing is collected while a run is being filled
+  while (i > 0) {
+    int run = (int) MIN((size_t) i, GC_BULK_MAX_SIZE / GC_OBJECT_SIZE(1));
+    gc_bulk bulk = gc_alloc_bulk(run, run * GC_OBJECT_SIZE(1));
+    for (int j = 0; j < run; j++) {
+      x = alloc_stella_object_bulk(&bulk, TAG_SUCC, 1);
+      STELLA_OBJECT_INIT_FIELD(x, 0, result);
+      result = x;
+    }
+    i -= run;
+  }
+#ifndef STELLA_GC_CONSERVATIVE
   gc_pop_root((void*)&result);
+#endif
   return result;
 }
 
 int stella_object_to_nat(stella_object* obj) {
   int result = 0;
   while (STELLA_OBJECT_HEADER_TAG(obj->object_header) == TAG_SUCC) {
+#ifdef STELLA_IMMEDIATE_NATS
+    if (STELLA_IS_IMMEDIATE(obj)) {
+      return result + (int) STELLA_IMMEDIATE_NAT_VALUE(obj);
+    }
+#endif
+#if STELLA_SMALL_NATS > 0
+    int value = small_nat_value(obj);
+    if (value) {
+      return result + value;
+    }
+#endif
     obj = STELLA_OBJECT_SUCC_ARG(obj);
     result += 1;
   }
@@ -66,17 +263,17 @@ stella_object* stella_object_nat_rec(stella_object* n, stella_object* z, stella_
   printf("f = "); print_stella_object(f);
   printf(")\n");
 #endif
-  gc_push_root((void**)&n);
-  gc_push_root((void**)&z);
-  gc_push_root((void**)&f);
+#ifndef STELLA_GC_CONSERVATIVE
+  size_t frame = gc_push_roots(3, (void**[]) { (void**)&n, (void**)&z, (void**)&f });
+#endif
   while (STELLA_OBJECT_HEADER_TAG(n->object_header) == TAG_SUCC) {
     n = STELLA_OBJECT_SUCC_ARG(n);
     g = STELLA_OBJECT_CLOSURE_CALL(f, n);
     z = STELLA_OBJECT_CLOSURE_CALL(g, z);
   }
-  gc_pop_root((void**)&f);
-  gc_pop_root((void**)&z);
-  gc_pop_root((void**)&n);
+#ifndef STELLA_GC_CONSERVATIVE
+  gc_pop_frame(frame);
+#endif
   return z;
 }
 
@@ -132,7 +329,7 @@ void print_stella_object(stella_object* obj) {
     case TAG_TUPLE:
       printf("{");
       for (int i = 0; i < fields_count; i++) {
-        print_stella_object(obj->object_fields[i]);
+        print_stella_object(STELLA_OBJECT_READ_FIELD(obj, i));
         if (i < fields_count - 1) { printf(", "); }
       }
       printf("}");  // TODO: pretty print a tuple
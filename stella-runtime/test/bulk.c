@@ -0,0 +1,86 @@
+//
+// Builds lists and long Nats in runs reserved with gc_alloc_bulk, checks that they survive
+// collections and that runs which cannot hold their objects are not reserved.
+// Usage: stella_gc_bulk_test
+//
+
+#include <stdio.h>
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+#define LIVE_LENGTH 20000
+/** Several runs of succ objects. */
+#define LARGE_NAT 100000
+#define ROUNDS 50
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    failures += !ok;
+}
+
+/** The list [one, zero, one, zero, ...] of length conses, built a run at a time. */
+static stella_object *make_list(stella_object *one, int length) {
+    stella_object *list = &the_EMPTY;
+    gc_push_root((void **) &one);
+    gc_push_root((void **) &list);
+    for (int i = 0; i < length;) {
+        int run = (int) MIN((size_t) (length - i), GC_BULK_MAX_SIZE / GC_OBJECT_SIZE(2));
+        gc_bulk bulk = gc_alloc_bulk(run, run * GC_OBJECT_SIZE(2));
+        for (int j = 0; j < run; j++, i++) {
+            stella_object *c = alloc_stella_object_bulk(&bulk, TAG_CONS, 2);
+            STELLA_OBJECT_INIT_FIELD(c, 0, i % 2 ? &the_ZERO : one);
+            STELLA_OBJECT_INIT_FIELD(c, 1, list);
+            list = c;
+        }
+    }
+    gc_pop_root((void **) &list);
+    gc_pop_root((void **) &one);
+    return list;
+}
+
+static long sum_list(stella_object *list) {
+    long sum = 0;
+    for (; STELLA_OBJECT_HEADER_TAG(list->object_header) == TAG_CONS; list = STELLA_OBJECT_READ_FIELD(list, 1)) {
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(list, 0));
+    }
+    return sum;
+}
+
+int main() {
+    stella_object *one = nat_to_stella_object(1);
+    gc_push_root((void **) &one);
+    stella_object *list = make_list(one, LIVE_LENGTH);
+    gc_push_root((void **) &list);
+    check(sum_list(list) == LIVE_LENGTH / 2, "a list built in runs");
+    stella_object *nat = nat_to_stella_object(LARGE_NAT);
+    gc_push_root((void **) &nat);
+    check(stella_object_to_nat(nat) == LARGE_NAT, "a Nat built in runs");
+
+    for (int round = 0; round < ROUNDS; round++) {
+        make_list(one, LIVE_LENGTH / 10);
+    }
+    check(sum_list(list) == LIVE_LENGTH / 2, "the list survives collections");
+    check(stella_object_to_nat(nat) == LARGE_NAT, "the Nat survives collections");
+    gc_pop_root((void **) &nat);
+    gc_pop_root((void **) &list);
+    gc_pop_root((void **) &one);
+
+    check(gc_alloc_bulk(0, GC_OBJECT_SIZE(1)).next == NULL, "no run for no objects");
+    check(gc_alloc_bulk(1, GC_BULK_MAX_SIZE + 1).next == NULL, "no run above GC_BULK_MAX_SIZE");
+    check(gc_alloc_bulk(4, 4 * GC_MIN_OBJ_SIZE - 1).next == NULL, "no run too small for its objects");
+#ifdef NDEBUG
+    // a failed assertion in debug builds
+    gc_bulk empty = {NULL, NULL};
+    check(alloc_stella_object_bulk(&empty, TAG_SUCC, 1) == NULL, "no object from an empty run");
+    gc_bulk bulk = gc_alloc_bulk(1, GC_OBJECT_SIZE(1));
+    stella_object *succ = alloc_stella_object_bulk(&bulk, TAG_SUCC, 1);
+    STELLA_OBJECT_INIT_FIELD(succ, 0, &the_ZERO);
+    check(alloc_stella_object_bulk(&bulk, TAG_SUCC, 1) == NULL, "no more objects than the run was reserved for");
+#endif
+
+    printf("%s\n", failures ? "bulk test FAILED" : "bulk test passed");
+    return failures != 0;
+}
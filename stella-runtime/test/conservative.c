@@ -0,0 +1,97 @@
+//
+// Keeps objects alive from variables on the native stack which are never pushed as roots:
+// a list, an object known only by a pointer into its middle and a large object survive
+// collections, pinned in place.
+// Exits with 77 (skipped) without STELLA_GC_CONSERVATIVE.
+// Usage: stella_gc_conservative_test
+//
+
+#include <stdio.h>
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+#define LIVE_LENGTH 20000
+/** Fields of the large tuple: well above LARGE_OBJECT_SIZE. */
+#define LARGE_FIELDS 1024
+#define ROUNDS 50
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    failures += !ok;
+}
+
+/** The list of length numbers, held by nothing but variables on the native stack while it is built. */
+static stella_object *make_list(int length) {
+    stella_object *volatile list = &the_EMPTY;
+    for (int i = 0; i < length; i++) {
+        stella_object *volatile head = nat_to_stella_object(i % 100);
+        stella_object *c = alloc_stella_object(TAG_CONS, 2);
+        STELLA_OBJECT_INIT_FIELD(c, 0, head);
+        STELLA_OBJECT_INIT_FIELD(c, 1, list);
+        list = c;
+    }
+    return list;
+}
+
+static long sum_list(stella_object *list) {
+    long sum = 0;
+    for (; STELLA_OBJECT_HEADER_TAG(list->object_header) == TAG_CONS; list = STELLA_OBJECT_READ_FIELD(list, 1)) {
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(list, 0));
+    }
+    return sum;
+}
+
+static long expected_sum(int length) {
+    long sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += i % 100;
+    }
+    return sum;
+}
+
+/** Allocate garbage, enough for several collections. */
+static void churn() {
+    for (int round = 0; round < ROUNDS; round++) {
+        make_list(LIVE_LENGTH / 10);
+    }
+}
+
+int main() {
+#ifndef STELLA_GC_CONSERVATIVE
+    printf("# ambiguous roots need STELLA_GC_CONSERVATIVE\n");
+    return 77;
+#endif
+    stella_object *volatile list = make_list(LIVE_LENGTH);
+    stella_object *head = list;
+    // a list which only a pointer to the second field of its first cons leads to
+    stella_object *volatile inner = make_list(LIVE_LENGTH / 10);
+    char *volatile inside = (char *) &inner->object_fields[1];
+    size_t offset = (size_t) (inside - (char *) inner);
+    inner = NULL;
+    stella_object *volatile large = alloc_stella_object(TAG_TUPLE, LARGE_FIELDS);
+    for (int i = 0; i < LARGE_FIELDS; i++) {
+        STELLA_OBJECT_INIT_FIELD(large, i, &the_ZERO);
+    }
+    STELLA_OBJECT_WRITE_FIELD(large, 0, make_list(LIVE_LENGTH / 10));
+
+    churn();
+    check(sum_list(list) == expected_sum(LIVE_LENGTH), "a list held by a stack variable survives");
+    check(list == head, "its first cons is pinned in place");
+    check(sum_list((stella_object *) (inside - offset)) == expected_sum(LIVE_LENGTH / 10),
+          "a list held by an interior pointer survives");
+    check(sum_list(STELLA_OBJECT_READ_FIELD(large, 0)) == expected_sum(LIVE_LENGTH / 10),
+          "a large object held by a stack variable keeps its fields alive");
+
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    gc_update_stats();
+    gc_stats *stats = gc_current_stats();
+    check(stats->gc_cycles > 0, "there were collections");
+    check(stats->ambiguous_roots > 0 && stats->pinned_bytes > 0, "objects were pinned by ambiguous roots");
+#endif
+
+    printf("%s\n", failures ? "conservative test FAILED" : "conservative test passed");
+    return failures != 0;
+}
@@ -0,0 +1,161 @@
+//
+// Works on several independent heaps: collections of one heap leave the objects, roots and
+// statistics of the others alone, and threads bound to heaps of their own run at the same time.
+// Exits with 77 (skipped) without STELLA_GC_CONTEXTS.
+// Usage: stella_gc_contexts_test
+//
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+#define THREADS 4
+#define LIVE_LENGTH 20000
+#define ROUNDS 50
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    failures += !ok;
+}
+
+static stella_object *cons(stella_object *head, stella_object *tail) {
+    gc_push_root((void **) &head);
+    gc_push_root((void **) &tail);
+    stella_object *c = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(c, 0, head);
+    STELLA_OBJECT_INIT_FIELD(c, 1, tail);
+    gc_pop_root((void **) &tail);
+    gc_pop_root((void **) &head);
+    return c;
+}
+
+static stella_object *make_list(int length) {
+    stella_object *list = &the_EMPTY;
+    gc_push_root((void **) &list);
+    for (int i = 0; i < length; i++) {
+        list = cons(nat_to_stella_object(i % 100), list);
+    }
+    gc_pop_root((void **) &list);
+    return list;
+}
+
+static long sum_list(stella_object *list) {
+    long sum = 0;
+    for (; STELLA_OBJECT_HEADER_TAG(list->object_header) == TAG_CONS; list = STELLA_OBJECT_READ_FIELD(list, 1)) {
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(list, 0));
+    }
+    return sum;
+}
+
+static long expected_sum(int length) {
+    long sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += i % 100;
+    }
+    return sum;
+}
+
+/** Allocate garbage on the bound heap, enough for several collections. */
+static void churn() {
+    for (int round = 0; round < ROUNDS; round++) {
+        make_list(LIVE_LENGTH / 10);
+    }
+}
+
+#ifdef STELLA_GC_CONTEXTS
+
+/** Whether p is in from-space or the nursery of the given heap. */
+static int is_in(gc_context *context, void *p) {
+    gc_state *state = &context->state;
+    return ((char *) p >= (char *) state->from_space && (char *) p < (char *) state->from_space + state->from_space_size)
+           || ((char *) p >= (char *) state->nursery && (char *) p < (char *) state->nursery + state->nursery_size);
+}
+
+/** A thread with a heap of its own, which it destroys at the end. */
+static void *thread_main(void *arg) {
+    int *intact = arg;
+    gc_context *context = gc_context_create();
+    if (!context) {
+        *intact = 0;
+        return NULL;
+    }
+    gc_context_bind(context);
+    stella_object *list = make_list(LIVE_LENGTH);
+    gc_push_root((void **) &list);
+    churn();
+    *intact = sum_list(list) == expected_sum(LIVE_LENGTH) && is_in(context, list);
+    gc_pop_root((void **) &list);
+    gc_context_destroy(context);
+    return NULL;
+}
+
+#endif
+
+int main() {
+#ifndef STELLA_GC_CONTEXTS
+    printf("# several heaps need STELLA_GC_CONTEXTS\n");
+    return 77;
+#else
+    stella_object *list = make_list(LIVE_LENGTH);
+    gc_push_root((void **) &list);
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    gc_update_stats();
+    size_t default_cycles = gc_default_context.statistics.gc_cycles;
+#endif
+
+    // a second heap, collected while the list of the default heap stays put
+    gc_context *other = gc_context_create();
+    check(other != NULL, "create a heap");
+    check(gc_context_bind(other) == &gc_default_context, "bind it instead of the default heap");
+    stella_object *before = list;
+    stella_object *other_list = make_list(LIVE_LENGTH / 2);
+    gc_push_root((void **) &other_list);
+    churn();
+    check(gc_current_state() == &other->state, "the bound heap is current");
+    check(is_in(other, other_list) && !is_in(other, list), "objects are allocated in the bound heap");
+    check(list == before && sum_list(list) == expected_sum(LIVE_LENGTH), "its collections leave the default heap alone");
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    gc_update_stats();
+    check(other->statistics.gc_cycles > 0, "the bound heap counts its collections");
+    check(gc_default_context.statistics.gc_cycles == default_cycles, "the default heap counts none of them");
+#endif
+
+    // and back: the second heap keeps its roots while the default heap is collected
+    check(gc_context_bind(NULL) == other, "go back to the default heap");
+    stella_object *other_before = other_list;
+    churn();
+    check(sum_list(list) == expected_sum(LIVE_LENGTH), "the list of the default heap survives its collections");
+    check(other_list == other_before && sum_list(other_list) == expected_sum(LIVE_LENGTH / 2),
+          "the other heap is left alone");
+
+    gc_context_bind(other);
+    churn();
+    check(sum_list(other_list) == expected_sum(LIVE_LENGTH / 2), "the other heap keeps its roots");
+    gc_pop_root((void **) &other_list);
+    gc_context_destroy(other);
+    check(gc_current_state() == &gc_default_context.state, "destroying the bound heap goes back to the default one");
+
+    // threads with a heap each, all collecting at the same time
+    pthread_t threads[THREADS];
+    int intact[THREADS];
+    int started = 0;
+    while (started < THREADS && !pthread_create(&threads[started], NULL, thread_main, &intact[started])) {
+        started++;
+    }
+    int all_intact = started == THREADS;
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        all_intact &= intact[i];
+    }
+    check(all_intact, "threads with a heap each keep their lists");
+    check(sum_list(list) == expected_sum(LIVE_LENGTH), "the default heap is intact at the end");
+
+    gc_pop_root((void **) &list);
+    printf("%s\n", failures ? "contexts test FAILED" : "contexts test passed");
+    return failures != 0;
+#endif
+}
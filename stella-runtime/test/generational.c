@@ -0,0 +1,126 @@
+//
+// Keeps young objects reachable only from old ones (a promoted ref cell, a large object tenured
+// directly) alive across minor collections.
+// Exits with 77 (skipped) without STELLA_GC_GENERATIONAL.
+// Usage: stella_gc_generational_test
+//
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+/** Fields of the large tuple: well above LARGE_OBJECT_SIZE, so it is allocated in the old generation. */
+#define LARGE_FIELDS 1024
+/** Lists young when the large tuple is initialized: they all fit into the nursery. */
+#define YOUNG_LISTS 32
+#define LIST_LENGTH 10
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    failures += !ok;
+}
+
+static stella_object *cons(stella_object *head, stella_object *tail) {
+    gc_push_root((void **) &head);
+    gc_push_root((void **) &tail);
+    stella_object *c = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(c, 0, head);
+    STELLA_OBJECT_INIT_FIELD(c, 1, tail);
+    gc_pop_root((void **) &tail);
+    gc_pop_root((void **) &head);
+    return c;
+}
+
+/** The list [first, first + 1, ..., first + LIST_LENGTH - 1]. */
+static stella_object *make_list(int first) {
+    stella_object *list = &the_EMPTY;
+    gc_push_root((void **) &list);
+    for (int i = LIST_LENGTH - 1; i >= 0; i--) {
+        list = cons(nat_to_stella_object(first + i), list);
+    }
+    gc_pop_root((void **) &list);
+    return list;
+}
+
+static int is_list(stella_object *list, int first) {
+    for (int i = 0; i < LIST_LENGTH; i++) {
+        if (STELLA_OBJECT_HEADER_TAG(list->object_header) != TAG_CONS
+            || stella_object_to_nat(STELLA_OBJECT_READ_FIELD(list, 0)) != first + i) {
+            return 0;
+        }
+        list = STELLA_OBJECT_READ_FIELD(list, 1);
+    }
+    return list == &the_EMPTY;
+}
+
+/** Allocate garbage until the nursery has been collected at least cycles more times. */
+static void churn(size_t cycles) {
+    gc_update_stats();
+    size_t until = gc_current_stats()->minor_gc_cycles + cycles;
+    while (gc_current_stats()->minor_gc_cycles < until) {
+        for (int i = 0; i < 1000; i++) {
+            cons(&the_ZERO, &the_EMPTY);
+        }
+        gc_update_stats();
+    }
+}
+
+/** Whether obj has left the nursery. */
+static int is_old(stella_object *obj) {
+    gc_state *state = gc_current_state();
+    return (uintptr_t) obj - (uintptr_t) state->nursery >= state->nursery_size;
+}
+
+int main() {
+#ifndef STELLA_GC_GENERATIONAL
+    printf("# the nursery needs STELLA_GC_GENERATIONAL\n");
+    return 77;
+#endif
+    // a ref cell which survives a minor collection, then points to a young list (the write barrier)
+    stella_object *ref = alloc_stella_object(TAG_REF, 1);
+    STELLA_OBJECT_INIT_FIELD(ref, 0, &the_ZERO);
+    gc_push_root((void **) &ref);
+    churn(1);
+    check(is_old(ref), "a surviving ref cell is promoted");
+    STELLA_OBJECT_WRITE_FIELD(ref, 0, make_list(100));
+    check(!is_old(STELLA_OBJECT_READ_FIELD(ref, 0)), "the list stored in it is young");
+    churn(2);
+    check(is_list(STELLA_OBJECT_READ_FIELD(ref, 0), 100), "a young list stored in an old ref cell survives");
+
+    // a large tuple, allocated in the old generation and initialized with young lists without a barrier
+    churn(1);
+    static stella_object *lists[YOUNG_LISTS];
+    for (int i = 0; i < YOUNG_LISTS; i++) {
+        lists[i] = make_list(i);
+        gc_push_root((void **) &lists[i]);
+    }
+    check(!is_old(lists[0]) && !is_old(lists[YOUNG_LISTS - 1]), "the lists are young");
+    stella_object *large = alloc_stella_object(TAG_TUPLE, LARGE_FIELDS);
+    for (int i = 0; i < LARGE_FIELDS; i++) {
+        STELLA_OBJECT_INIT_FIELD(large, i, i < YOUNG_LISTS ? lists[i] : &the_ZERO);
+    }
+    check(is_old(large), "the large tuple is old");
+    for (int i = YOUNG_LISTS - 1; i >= 0; i--) {
+        gc_pop_root((void **) &lists[i]);
+    }
+    gc_push_root((void **) &large);
+    churn(2);
+    int intact = 1;
+    for (int i = 0; i < YOUNG_LISTS; i++) {
+        intact &= is_list(STELLA_OBJECT_READ_FIELD(large, i), i);
+    }
+    check(intact, "young lists held only by a large object survive");
+    gc_pop_root((void **) &large);
+    gc_pop_root((void **) &ref);
+
+    gc_update_stats();
+    check(gc_current_stats()->promoted_bytes > 0, "objects were promoted");
+    check(gc_current_state()->remembered_size == 0, "the remembered set is empty after a minor collection");
+
+    printf("%s\n", failures ? "generational test FAILED" : "generational test passed");
+    return failures != 0;
+}
@@ -0,0 +1,119 @@
+//
+// Runs several mutator threads on the shared heap: each one builds and drops lists of its own
+// and reads a list of the main thread, which waits for them blocked, across many collections.
+// Exits with 77 (skipped) without STELLA_GC_MULTI_MUTATOR.
+// Usage: stella_gc_mutators_test
+//
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+#define THREADS 4
+/** Conses every thread keeps live while it churns. */
+#define KEPT_LENGTH 20000
+#define SHARED_LENGTH 1000
+#define ROUNDS 100
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    failures += !ok;
+}
+
+static stella_object *cons(stella_object *head, stella_object *tail) {
+    gc_push_root((void **) &head);
+    gc_push_root((void **) &tail);
+    stella_object *c = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(c, 0, head);
+    STELLA_OBJECT_INIT_FIELD(c, 1, tail);
+    gc_pop_root((void **) &tail);
+    gc_pop_root((void **) &head);
+    return c;
+}
+
+static stella_object *make_list(int length) {
+    stella_object *list = &the_EMPTY;
+    gc_push_root((void **) &list);
+    for (int i = 0; i < length; i++) {
+        list = cons(nat_to_stella_object(i % 100), list);
+    }
+    gc_pop_root((void **) &list);
+    return list;
+}
+
+static long sum_list(stella_object *list) {
+    long sum = 0;
+    for (; STELLA_OBJECT_HEADER_TAG(list->object_header) == TAG_CONS; list = STELLA_OBJECT_READ_FIELD(list, 1)) {
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(list, 0));
+    }
+    return sum;
+}
+
+static long expected_sum(int length) {
+    long sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += i % 100;
+    }
+    return sum;
+}
+
+/** Rooted by the main thread, which the collector updates while it is blocked. */
+static stella_object *shared;
+
+static void *mutator_main(void *arg) {
+    int *intact = arg;
+    gc_register_thread();
+    stella_object *kept = make_list(KEPT_LENGTH);
+    gc_push_root((void **) &kept);
+    *intact = 1;
+    for (int round = 0; round < ROUNDS; round++) {
+        make_list(KEPT_LENGTH / 10);
+        *intact &= sum_list(shared) == expected_sum(SHARED_LENGTH);
+    }
+    *intact &= sum_list(kept) == expected_sum(KEPT_LENGTH);
+    gc_pop_root((void **) &kept);
+    gc_unregister_thread();
+    return NULL;
+}
+
+int main() {
+#ifndef STELLA_GC_MULTI_MUTATOR
+    printf("# several mutator threads need STELLA_GC_MULTI_MUTATOR\n");
+    return 77;
+#endif
+    shared = make_list(SHARED_LENGTH);
+    gc_push_root((void **) &shared);
+
+    pthread_t threads[THREADS];
+    int intact[THREADS];
+    int started = 0;
+    while (started < THREADS && !pthread_create(&threads[started], NULL, mutator_main, &intact[started])) {
+        started++;
+    }
+    gc_blocking_begin();
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    gc_blocking_end();
+
+    check(started == THREADS, "the mutator threads started");
+    int all_intact = 1;
+    for (int i = 0; i < started; i++) {
+        all_intact &= intact[i];
+    }
+    check(all_intact, "the lists of every thread and the shared list stay intact");
+    make_list(KEPT_LENGTH);
+    check(sum_list(shared) == expected_sum(SHARED_LENGTH), "the main thread allocates again afterwards");
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    gc_update_stats();
+    check(gc_current_stats()->gc_cycles > 0, "the threads were stopped for collections");
+#endif
+
+    gc_pop_root((void **) &shared);
+    printf("%s\n", failures ? "mutators test FAILED" : "mutators test passed");
+    return failures != 0;
+}
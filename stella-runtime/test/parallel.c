@@ -0,0 +1,141 @@
+//
+// Evacuates a live heap above GC_PARALLEL_MIN_HEAP with several worker threads: a long list and
+// many tuples sharing one list, which the workers race to copy, come out intact and still shared.
+// Exits with 77 (skipped) without STELLA_GC_PARALLEL.
+// Usage: stella_gc_parallel_test
+//
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+/** Conses of the live list: several MB, well above GC_PARALLEL_MIN_HEAP. */
+#define LIVE_LENGTH 200000
+/** Tuples which all point to the same shared list. */
+#define SHARING_TUPLES 10000
+#define SHARED_LENGTH 100
+#define ROUNDS 50
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    failures += !ok;
+}
+
+static stella_object *cons(stella_object *head, stella_object *tail) {
+    gc_push_root((void **) &head);
+    gc_push_root((void **) &tail);
+    stella_object *c = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(c, 0, head);
+    STELLA_OBJECT_INIT_FIELD(c, 1, tail);
+    gc_pop_root((void **) &tail);
+    gc_pop_root((void **) &head);
+    return c;
+}
+
+static stella_object *make_list(int length) {
+    stella_object *list = &the_EMPTY;
+    gc_push_root((void **) &list);
+    for (int i = 0; i < length; i++) {
+        list = cons(nat_to_stella_object(i % 100), list);
+    }
+    gc_pop_root((void **) &list);
+    return list;
+}
+
+/** A list of SHARING_TUPLES tuples {shared, i % 100}. */
+static stella_object *make_tuples(stella_object *shared) {
+    stella_object *list = &the_EMPTY;
+    gc_push_root((void **) &shared);
+    gc_push_root((void **) &list);
+    for (int i = 0; i < SHARING_TUPLES; i++) {
+        stella_object *tuple = alloc_stella_object(TAG_TUPLE, 2);
+        STELLA_OBJECT_INIT_FIELD(tuple, 0, shared);
+        STELLA_OBJECT_INIT_FIELD(tuple, 1, &the_ZERO);
+        gc_push_root((void **) &tuple);
+        stella_object *n = nat_to_stella_object(i % 100);
+        STELLA_OBJECT_WRITE_FIELD(tuple, 1, n);
+        list = cons(tuple, list);
+        gc_pop_root((void **) &tuple);
+    }
+    gc_pop_root((void **) &list);
+    gc_pop_root((void **) &shared);
+    return list;
+}
+
+static long sum_list(stella_object *list) {
+    long sum = 0;
+    for (; STELLA_OBJECT_HEADER_TAG(list->object_header) == TAG_CONS; list = STELLA_OBJECT_READ_FIELD(list, 1)) {
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(list, 0));
+    }
+    return sum;
+}
+
+static long expected_sum(int length) {
+    long sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += i % 100;
+    }
+    return sum;
+}
+
+/** Whether every tuple still points to shared, and the second fields add up. */
+static int tuples_intact(stella_object *tuples, stella_object *shared) {
+    long sum = 0;
+    int count = 0;
+    for (; STELLA_OBJECT_HEADER_TAG(tuples->object_header) == TAG_CONS; tuples = STELLA_OBJECT_READ_FIELD(tuples, 1)) {
+        stella_object *tuple = STELLA_OBJECT_READ_FIELD(tuples, 0);
+        if (STELLA_OBJECT_READ_FIELD(tuple, 0) != shared) {
+            return 0;
+        }
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(tuple, 1));
+        count++;
+    }
+    return count == SHARING_TUPLES && sum == expected_sum(SHARING_TUPLES);
+}
+
+int main() {
+#ifndef STELLA_GC_PARALLEL
+    printf("# the worker threads need STELLA_GC_PARALLEL\n");
+    return 77;
+#endif
+    // before the first allocation, which starts the workers: several even on a single CPU
+    setenv("STELLA_GC_THREADS", "4", 1);
+
+    stella_object *list = make_list(LIVE_LENGTH);
+    gc_push_root((void **) &list);
+    stella_object *shared = make_list(SHARED_LENGTH);
+    gc_push_root((void **) &shared);
+    stella_object *tuples = make_tuples(shared);
+    gc_push_root((void **) &tuples);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        make_list(LIVE_LENGTH / 10);
+    }
+    check(sum_list(list) == expected_sum(LIVE_LENGTH), "the live list is intact");
+    check(sum_list(shared) == expected_sum(SHARED_LENGTH), "the shared list is intact");
+    check(tuples_intact(tuples, shared), "the tuples are intact and share one copy of the list");
+
+#if STELLA_GC_STATS_LEVEL >= STELLA_GC_STATS_CHEAP
+    gc_update_stats();
+    gc_stats *stats = gc_current_stats();
+    check(stats->gc_workers == 4, "four workers were started");
+    check(stats->parallel_cycles > 0, "cycles were evacuated in parallel");
+    size_t copied = 0;
+    for (size_t i = 0; i < stats->gc_workers; i++) {
+        copied += stats->workers[i].copied_bytes;
+    }
+    check(copied > 0, "the workers copied objects");
+#endif
+
+    gc_pop_root((void **) &tuples);
+    gc_pop_root((void **) &shared);
+    gc_pop_root((void **) &list);
+    printf("%s\n", failures ? "parallel test FAILED" : "parallel test passed");
+    return failures != 0;
+}
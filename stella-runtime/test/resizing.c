@@ -0,0 +1,112 @@
+//
+// Grows the heap past its initial size for a large live list, shrinks it back once the list is dropped,
+// and checks that a process over its maximum heap size stops with an error.
+// Usage: stella_gc_resizing_test
+//
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+/** Conses of the live list: several MB, far above the initial heap. */
+#define LIVE_LENGTH 200000
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    failures += !ok;
+}
+
+static stella_object *cons(stella_object *head, stella_object *tail) {
+    gc_push_root((void **) &head);
+    gc_push_root((void **) &tail);
+    stella_object *c = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(c, 0, head);
+    STELLA_OBJECT_INIT_FIELD(c, 1, tail);
+    gc_pop_root((void **) &tail);
+    gc_pop_root((void **) &head);
+    return c;
+}
+
+static stella_object *make_list(int length) {
+    stella_object *list = &the_EMPTY;
+    gc_push_root((void **) &list);
+    for (int i = 0; i < length; i++) {
+        list = cons(nat_to_stella_object(i % 100), list);
+    }
+    gc_pop_root((void **) &list);
+    return list;
+}
+
+static long sum_list(stella_object *list) {
+    long sum = 0;
+    for (; STELLA_OBJECT_HEADER_TAG(list->object_header) == TAG_CONS; list = STELLA_OBJECT_READ_FIELD(list, 1)) {
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(list, 0));
+    }
+    return sum;
+}
+
+static long expected_sum(int length) {
+    long sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += i % 100;
+    }
+    return sum;
+}
+
+/** The compact backend shrinks its heap in place, moving limit down. */
+static size_t heap_size() {
+#ifdef STELLA_GC_BACKEND_COMPACT
+    return (size_t) ((char *) gc_current_state()->limit - (char *) gc_current_state()->from_space);
+#else
+    return gc_current_state()->from_space_size;
+#endif
+}
+
+/** Keep a large list alive in a heap limited to 1 MB: the process must stop with an error. */
+static int over_the_limit() {
+    pid_t child = fork();
+    if (child == 0) {
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+        setenv("STELLA_GC_MAX_HEAP", "1m", 1);
+        stella_object *list = make_list(LIVE_LENGTH);
+        gc_push_root((void **) &list);
+        make_list(LIVE_LENGTH);
+        _exit(0);
+    }
+    int status;
+    return child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) != 0;
+}
+
+int main() {
+    // before the first allocation, which reads the configuration
+    check(over_the_limit(), "a live heap over STELLA_GC_MAX_HEAP stops the process");
+    setenv("STELLA_GC_INITIAL_HEAP", "256k", 1);
+    setenv("STELLA_GC_MAX_HEAP", "256m", 1);
+
+    make_list(10);
+    size_t initial = heap_size();
+    stella_object *list = make_list(LIVE_LENGTH);
+    gc_push_root((void **) &list);
+    make_list(LIVE_LENGTH);
+    size_t grown = heap_size();
+    check(grown > initial, "the heap grows for a live list larger than its initial size");
+    check(sum_list(list) == expected_sum(LIVE_LENGTH), "the list is intact");
+    gc_pop_root((void **) &list);
+
+    for (int round = 0; round < 100; round++) {
+        make_list(LIVE_LENGTH / 10);
+    }
+    check(heap_size() < grown, "the heap shrinks once the list is dropped");
+
+    printf("%s\n", failures ? "resizing test FAILED" : "resizing test passed");
+    return failures != 0;
+}
@@ -0,0 +1,166 @@
+//
+// Saves a heap image, loads it back and checks that invalid images are rejected.
+// Exits with 77 (skipped) where heap images are not available (STELLA_COMPRESSED_REFS).
+// Usage: stella_gc_snapshot_test
+//
+
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stella/runtime.h"
+#include "stella/gc.h"
+
+/** Offsets of the counts in the header of an image (see gc.c). */
+#define IMAGE_WORDS_OFFSET 32
+#define IMAGE_RELOCATIONS_OFFSET 40
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    failures += !ok;
+}
+
+static stella_object *cons(stella_object *head, stella_object *tail) {
+    gc_push_root((void **) &head);
+    gc_push_root((void **) &tail);
+    stella_object *c = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(c, 0, head);
+    STELLA_OBJECT_INIT_FIELD(c, 1, tail);
+    gc_pop_root((void **) &tail);
+    gc_pop_root((void **) &head);
+    return c;
+}
+
+static stella_object *make_list(int length) {
+    stella_object *list = &the_EMPTY;
+    gc_push_root((void **) &list);
+    for (int i = 0; i < length; i++) {
+        stella_object *n = nat_to_stella_object(i % 100);
+        list = cons(n, list);
+    }
+    gc_pop_root((void **) &list);
+    return list;
+}
+
+static long sum_list(stella_object *list) {
+    long sum = 0;
+    for (; STELLA_OBJECT_HEADER_TAG(list->object_header) == TAG_CONS; list = STELLA_OBJECT_READ_FIELD(list, 1)) {
+        sum += stella_object_to_nat(STELLA_OBJECT_READ_FIELD(list, 0));
+    }
+    return sum;
+}
+
+static long expected_sum(int length) {
+    long sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += i % 100;
+    }
+    return sum;
+}
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        return NULL;
+    }
+    fseek(in, 0, SEEK_END);
+    *size = (size_t) ftell(in);
+    rewind(in);
+    char *data = malloc(*size);
+    if (data && fread(data, 1, *size, in) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(in);
+    return data;
+}
+
+static void write_file(const char *path, const char *data, size_t size) {
+    FILE *out = fopen(path, "wb");
+    if (!out || fwrite(data, 1, size, out) != size || fclose(out)) {
+        perror(path);
+        exit(1);
+    }
+}
+
+/** Write data (changed by the caller) to path and check that it is not loaded. */
+static void check_rejected(const char *path, const char *data, size_t size, const char *what) {
+    write_file(path, data, size);
+    size_t count = 0;
+    check(gc_load_snapshot(path, &count) == NULL, what);
+}
+
+int main() {
+#ifdef STELLA_COMPRESSED_REFS
+    printf("# heap images are not available with STELLA_COMPRESSED_REFS\n");
+    return 77;
+#endif
+    char path[] = "/tmp/stella_snapshot_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    close(fd);
+
+    // round trip: the loaded list survives collections of the heap which points to it
+    stella_object *list = make_list(1000);
+    gc_push_root((void **) &list);
+    check(gc_save_snapshot(path, (void **) &list, 1), "save a list");
+    size_t count = 0;
+    void **loaded = gc_load_snapshot(path, &count);
+    check(loaded && count == 1, "load it back");
+    if (loaded && count == 1) {
+        stella_object *head = cons(nat_to_stella_object(1), (stella_object *) loaded[0]);
+        gc_push_root((void **) &head);
+        for (int round = 0; round < 200; round++) {
+            make_list(5000);
+        }
+        check(sum_list(head) == 1 + expected_sum(1000), "the loaded list is intact after collections");
+        gc_pop_root((void **) &head);
+    }
+
+    stella_object *ref = alloc_stella_object(TAG_REF, 1);
+    STELLA_OBJECT_INIT_FIELD(ref, 0, &the_ZERO);
+    check(!gc_save_snapshot(path, (void **) &ref, 1), "refuse to save a reference cell");
+
+    // invalid images, derived from a valid one
+    check(gc_save_snapshot(path, (void **) &list, 1), "save the list again");
+    gc_pop_root((void **) &list);
+    size_t size = 0;
+    char *image = read_file(path, &size);
+    if (!image || size < IMAGE_RELOCATIONS_OFFSET + sizeof(uint64_t)) {
+        perror(path);
+        return 1;
+    }
+    char *bad = malloc(size);
+    uint64_t words, relocations;
+    memcpy(&words, image + IMAGE_WORDS_OFFSET, sizeof words);
+    memcpy(&relocations, image + IMAGE_RELOCATIONS_OFFSET, sizeof relocations);
+
+    check_rejected(path, "not an image", 12, "reject a file which is not an image");
+    memcpy(bad, image, size);
+    bad[0] ^= 1;
+    check_rejected(path, bad, size, "reject a bad magic");
+    check_rejected(path, image, size - sizeof(uint64_t), "reject a truncated image");
+    memcpy(bad, image, size);
+    uint64_t huge_words = words + ((uint64_t) 1 << 61);  // the size in bytes wraps around to the right one
+    memcpy(bad + IMAGE_WORDS_OFFSET, &huge_words, sizeof huge_words);
+    check_rejected(path, bad, size, "reject a word count which overflows");
+    memcpy(bad, image, size);
+    uint64_t huge_relocations = relocations + ((uint64_t) 1 << 61);
+    memcpy(bad + IMAGE_RELOCATIONS_OFFSET, &huge_relocations, sizeof huge_relocations);
+    check_rejected(path, bad, size, "reject a relocation count which overflows");
+
+    free(bad);
+    free(image);
+    unlink(path);
+    printf("%s\n", failures ? "snapshot test FAILED" : "snapshot test passed");
+    return failures != 0;
+}